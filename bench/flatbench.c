@@ -0,0 +1,236 @@
+/* Traversal speed of the pointer-based syntax tree against the
+ * index-based one in flat.h, on a synthetic program shaped like the
+ * simplified trees vslc builds: functions holding lists of assignments
+ * and prints over random expressions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vslc.h>
+
+#define N_FUNCTIONS 500
+#define N_STATEMENTS 200
+#define EXPRESSION_DEPTH 4
+#define ROUNDS 20
+
+static node_t *root;
+static arena_t tree_arena;
+static intern_pool_t identifiers;
+
+static ident_t *names[16];
+
+typedef struct {
+    uint64_t n_nodes;
+    int64_t sum;
+} tally_t;
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static node_t *
+new_node ( node_index_t type, void *data, uint64_t n_children, ... )
+{
+    va_list children;
+    node_t *node = arena_alloc ( &tree_arena, sizeof(node_t) );
+    *node = (node_t) {
+        .type = type, .op = OP_NONE, .data = data, .entry = NULL,
+        .n_children = n_children,
+        .children = arena_alloc ( &tree_arena, n_children * sizeof(node_t *) )
+    };
+    va_start ( children, n_children );
+    for ( uint64_t i=0; i<n_children; i++ )
+        node->children[i] = va_arg ( children, node_t * );
+    va_end ( children );
+    return node;
+}
+
+
+static node_t *
+new_list ( node_index_t type, size_t n )
+{
+    node_t *list = new_node ( type, NULL, 0 );
+    list->n_children = n;
+    list->children = arena_alloc ( &tree_arena, n * sizeof(node_t *) );
+    return list;
+}
+
+
+/* Leaves are built before their parents, as the parser does */
+static node_t *
+make_expression ( int depth )
+{
+    if ( depth == 0 || rand() % 4 == 0 )
+    {
+        if ( rand() % 2 )
+            return new_node ( IDENTIFIER_DATA, names[rand() % 16], 0 );
+        int64_t *value = arena_alloc ( &tree_arena, sizeof(int64_t) );
+        *value = rand() % 1000;
+        return new_node ( NUMBER_DATA, value, 0 );
+    }
+    node_t *left = make_expression ( depth-1 );
+    node_t *right = make_expression ( depth-1 );
+    node_t *expression = new_node ( EXPRESSION, NULL, 2, left, right );
+    expression->op = OP_OR + rand() % (OP_DIV - OP_OR + 1);
+    return expression;
+}
+
+
+static node_t *
+make_program ( void )
+{
+    node_t *functions = new_list ( GLOBAL_LIST, N_FUNCTIONS );
+    for ( size_t f=0; f<N_FUNCTIONS; f++ )
+    {
+        node_t *statements = new_list ( STATEMENT_LIST, N_STATEMENTS );
+        for ( size_t s=0; s<N_STATEMENTS; s++ )
+        {
+            node_t *value = make_expression ( EXPRESSION_DEPTH );
+            if ( s % 8 == 0 )
+                statements->children[s] = new_node (
+                    PRINT_STATEMENT, NULL, 1, value
+                );
+            else
+                statements->children[s] = new_node (
+                    ASSIGNMENT_STATEMENT, NULL, 2,
+                    new_node ( IDENTIFIER_DATA, names[rand() % 16], 0 ),
+                    value
+                );
+        }
+        functions->children[f] = new_node (
+            FUNCTION, NULL, 3,
+            new_node ( IDENTIFIER_DATA, names[f % 16], 0 ),
+            NULL,
+            new_node ( BLOCK, NULL, 1, statements )
+        );
+    }
+    return new_node ( PROGRAM, NULL, 1, functions );
+}
+
+
+static void
+tally_recursive ( node_t *node, tally_t *tally )
+{
+    tally->n_nodes += 1;
+    if ( node->type == NUMBER_DATA )
+        tally->sum += *((int64_t *)node->data);
+    for ( uint64_t i=0; i<node->n_children; i++ )
+        if ( node->children[i] != NULL )
+            tally_recursive ( node->children[i], tally );
+}
+
+
+static int
+tally_node ( node_t **slot, uint64_t depth, void *context )
+{
+    tally_t *tally = context;
+    if ( *slot != NULL )
+    {
+        tally->n_nodes += 1;
+        if ( (*slot)->type == NUMBER_DATA )
+            tally->sum += *((int64_t *)(*slot)->data);
+    }
+    return WALK_CONTINUE;
+}
+
+
+static int
+tally_flat_node ( flat_tree_t *tree, flat_index_t n, uint64_t depth, void *context )
+{
+    tally_t *tally = context;
+    if ( n != FLAT_NONE )
+    {
+        tally->n_nodes += 1;
+        if ( tree->nodes[n].type == NUMBER_DATA )
+            tally->sum += tree->nodes[n].data.number;
+    }
+    return WALK_CONTINUE;
+}
+
+
+static void
+report ( const char *label, double elapsed, tally_t *tally )
+{
+    printf (
+        "%-24s %8.2f ms/walk %6.2f ns/node  (%lu nodes, sum %ld)\n",
+        label, elapsed * 1e3 / ROUNDS,
+        elapsed * 1e9 / ROUNDS / tally->n_nodes, tally->n_nodes, tally->sum
+    );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    char name[16];
+    srand ( 4205 );
+    arena_init ( &tree_arena, ARENA_CHUNK_SIZE );
+    intern_init ( &identifiers, 64 );
+    for ( int i=0; i<16; i++ )
+    {
+        snprintf ( name, sizeof(name), "x%d", i );
+        names[i] = intern ( &identifiers, name );
+    }
+    root = make_program ( );
+
+    tally_t tally;
+    double start;
+
+    flat_tree_t flat;
+    start = now ( );
+    flat_init ( &flat, 0 );
+    if ( flat_from_tree ( &flat, root, false ) != FLAT_SUCCESS )
+    {
+        fprintf ( stderr, "conversion failed\n" );
+        return EXIT_FAILURE;
+    }
+    printf ( "conversion: %.2f ms\n", (now ( ) - start) * 1e3 );
+    printf (
+        "node_t tree: %zu bytes in the arena, flat tree: %zu bytes\n",
+        tree_arena.n_bytes,
+        flat.n_nodes * sizeof(flat_node_t) + flat.n_edges * sizeof(flat_index_t)
+    );
+
+    tally = (tally_t) { 0 };
+    start = now ( );
+    for ( int r=0; r<ROUNDS; r++ )
+        tally_recursive ( root, &tally );
+    report ( "node_t, recursive", now ( ) - start, &tally );
+
+    tally = (tally_t) { 0 };
+    start = now ( );
+    for ( int r=0; r<ROUNDS; r++ )
+        tree_walk ( &root, tally_node, NULL, &tally );
+    report ( "node_t, tree_walk", now ( ) - start, &tally );
+
+    tally = (tally_t) { 0 };
+    start = now ( );
+    for ( int r=0; r<ROUNDS; r++ )
+        flat_walk ( &flat, FLAT_ROOT, tally_flat_node, NULL, &tally );
+    report ( "flat, flat_walk", now ( ) - start, &tally );
+
+    /* Passes that only need pre-order need no walk at all */
+    tally = (tally_t) { 0 };
+    start = now ( );
+    for ( int r=0; r<ROUNDS; r++ )
+        for ( flat_index_t n=0; n<flat.n_nodes; n++ )
+        {
+            tally.n_nodes += 1;
+            if ( flat.nodes[n].type == NUMBER_DATA )
+                tally.sum += flat.nodes[n].data.number;
+        }
+    report ( "flat, pre-order scan", now ( ) - start, &tally );
+
+    flat_finalize ( &flat );
+    arena_release ( &tree_arena );
+    intern_finalize ( &identifiers );
+    return EXIT_SUCCESS;
+}
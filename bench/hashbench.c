@@ -0,0 +1,238 @@
+/* Throughput of the tlhash hash backends on the keys the compiler
+ * hashes. Identifier names are hashed once with the backend, when the
+ * intern pool first sees them. Symbol tables are keyed on the 16-byte
+ * symbol_key_t that make_symbol_key builds from a scope and an interned
+ * name, mixing the name's stored hash with the scope, and are used
+ * through the _hashed functions. The backends are timed on those keys
+ * too, as the plain functions would hash them, and so are lookups both
+ * ways.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vslc.h>
+
+#define N_KEYS 4096
+#define TARGET_BYTES (256u*1024*1024)
+#define TARGET_LOOKUPS (16u*1024*1024)
+
+typedef struct {
+    const char *label;
+    size_t n;
+    uint8_t *keys[N_KEYS];
+    size_t lengths[N_KEYS];
+    size_t total;
+} keyset_t;
+
+/* Symbol keys, and the scopes and names they are made from */
+typedef struct {
+    size_t n;
+    uint64_t scopes[N_KEYS];
+    ident_t *names[N_KEYS];
+    symbol_key_t keys[N_KEYS];
+} symbols_t;
+
+static const char *words[] = {
+    "x", "y", "i", "n", "a", "b", "next", "estimate", "square_root",
+    "fibonacci", "counter", "result", "improve", "tmp", "gcd", "factor",
+    "remainder", "left_operand", "print_item", "value"
+};
+#define N_WORDS (sizeof(words) / sizeof(words[0]))
+#define N_BACKENDS 3
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static void
+add_key ( keyset_t *set, const void *key, size_t length )
+{
+    set->keys[set->n] = malloc ( length );
+    memcpy ( set->keys[set->n], key, length );
+    set->lengths[set->n] = length;
+    set->total += length;
+    set->n += 1;
+}
+
+
+/* Names like the ones in the sample programs, some with numeric suffixes */
+static void
+make_identifiers ( keyset_t *set )
+{
+    char name[64];
+    for ( size_t i=0; i<N_KEYS; i++ )
+    {
+        const char *w = words[rand() % N_WORDS];
+        if ( i % 3 == 0 )
+            snprintf ( name, sizeof(name), "%s%zu", w, i );
+        else
+            snprintf ( name, sizeof(name), "%s", w );
+        add_key ( set, name, strlen ( name ) );
+    }
+}
+
+
+/* The identifiers, interned, each in a scope of a function with up to
+ * 64 blocks; the global scope for a tenth of them
+ */
+static void
+make_symbols ( symbols_t *symbols, keyset_t *identifiers, intern_pool_t *pool, keyset_t *set )
+{
+    char name[64];
+    for ( size_t i=0; i<identifiers->n; i++ )
+    {
+        memcpy ( name, identifiers->keys[i], identifiers->lengths[i] );
+        name[identifiers->lengths[i]] = '\0';
+        symbols->names[i] = intern ( pool, name );
+        symbols->scopes[i] = ( rand() % 10 == 0 ) ? GLOBAL_SCOPE : 1 + rand() % 64;
+        make_symbol_key ( &symbols->keys[i], symbols->scopes[i], symbols->names[i] );
+        add_key ( set, &symbols->keys[i], sizeof(symbol_key_t) );
+    }
+    symbols->n = identifiers->n;
+}
+
+
+static void
+run ( keyset_t *set, const char *backend )
+{
+    size_t rounds = TARGET_BYTES / set->total + 1;
+    uint32_t sink = 0;
+    double start = now ( );
+    for ( size_t r=0; r<rounds; r++ )
+        for ( size_t k=0; k<set->n; k++ )
+            sink += tlhash_hash ( set->keys[k], set->lengths[k] );
+    double elapsed = now ( ) - start;
+    double n_hashed = (double)rounds * set->n;
+    printf (
+        "%-22s %-16s %8.2f ns/key %9.1f MB/s  (%08x)\n",
+        set->label, backend, elapsed * 1e9 / n_hashed,
+        rounds * (double)set->total / elapsed / 1e6, sink
+    );
+}
+
+
+/* What the _hashed path pays instead of a backend */
+static void
+run_mixed ( symbols_t *symbols, keyset_t *set )
+{
+    size_t rounds = TARGET_BYTES / set->total + 1;
+    uint32_t sink = 0;
+    symbol_key_t key;
+    double start = now ( );
+    for ( size_t r=0; r<rounds; r++ )
+        for ( size_t k=0; k<symbols->n; k++ )
+            sink += make_symbol_key ( &key, symbols->scopes[k], symbols->names[k] );
+    double elapsed = now ( ) - start;
+    double n_hashed = (double)rounds * symbols->n;
+    printf (
+        "%-22s %-16s %8.2f ns/key %9.1f MB/s  (%08x)\n",
+        set->label, "make_symbol_key", elapsed * 1e9 / n_hashed,
+        rounds * (double)set->total / elapsed / 1e6, sink
+    );
+}
+
+
+/* Every key looked up in a table holding them all, once through the
+ * _hashed functions with the key made as resolve_name makes it, and
+ * once through the plain ones with the selected backend
+ */
+static void
+run_lookups ( symbols_t *symbols, const char *backend )
+{
+    tlhash_t hashed, plain;
+    if ( tlhash_init ( &hashed, symbols->n ) != TLHASH_SUCCESS ||
+         tlhash_init ( &plain, symbols->n ) != TLHASH_SUCCESS )
+        exit ( EXIT_FAILURE );
+    for ( size_t k=0; k<symbols->n; k++ )
+    {
+        symbol_key_t key;
+        uint32_t hash = make_symbol_key ( &key, symbols->scopes[k], symbols->names[k] );
+        tlhash_insert_hashed ( &hashed, &key, sizeof(key), hash, symbols->names[k] );
+        tlhash_insert ( &plain, &key, sizeof(key), symbols->names[k] );
+    }
+
+    size_t rounds = TARGET_LOOKUPS / symbols->n + 1;
+    uintptr_t sink = 0;
+    void *value;
+    double start = now ( );
+    for ( size_t r=0; r<rounds; r++ )
+        for ( size_t k=0; k<symbols->n; k++ )
+        {
+            symbol_key_t key;
+            uint32_t hash = make_symbol_key ( &key, symbols->scopes[k], symbols->names[k] );
+            tlhash_lookup_hashed ( &hashed, &key, sizeof(key), hash, &value );
+            sink += (uintptr_t) value;
+        }
+    double hashed_time = now ( ) - start;
+    start = now ( );
+    for ( size_t r=0; r<rounds; r++ )
+        for ( size_t k=0; k<symbols->n; k++ )
+        {
+            tlhash_lookup ( &plain, &symbols->keys[k], sizeof(symbol_key_t), &value );
+            sink += (uintptr_t) value;
+        }
+    double plain_time = now ( ) - start;
+
+    double n_lookups = (double)rounds * symbols->n;
+    printf (
+        "%-22s %-16s %8.2f ns/lookup _hashed, %8.2f ns/lookup plain  (%zx)\n",
+        "symbol table lookups", backend, hashed_time * 1e9 / n_lookups,
+        plain_time * 1e9 / n_lookups, (size_t)(sink & 0xffff)
+    );
+    tlhash_finalize ( &hashed );
+    tlhash_finalize ( &plain );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    static keyset_t sets[2] = {
+        { .label = "identifiers" },
+        { .label = "symbol keys" }
+    };
+    static symbols_t symbols;
+    const char *backends[N_BACKENDS] = { "crc32", "crc32c", "mum" };
+
+    srand ( 4205 );
+    make_identifiers ( &sets[0] );
+    intern_pool_t pool;
+    if ( intern_init ( &pool, 1024 ) != INTERN_SUCCESS )
+        return EXIT_FAILURE;
+    make_symbols ( &symbols, &sets[0], &pool, &sets[1] );
+
+    for ( size_t s=0; s<2; s++ )
+    {
+        printf (
+            "%s: %zu keys, %.1f bytes on average\n",
+            sets[s].label, sets[s].n, (double)sets[s].total / sets[s].n
+        );
+        for ( size_t b=0; b<N_BACKENDS; b++ )
+        {
+            if ( tlhash_set_hash ( backends[b] ) != TLHASH_SUCCESS )
+                printf ( "%-22s %-16s unsupported on this CPU\n",
+                    sets[s].label, backends[b] );
+            else
+                run ( &sets[s], backends[b] );
+        }
+        if ( s == 1 )
+            run_mixed ( &symbols, &sets[s] );
+    }
+
+    /* The names were interned under the default backend, and the
+     * _hashed path keeps their hashes whichever one the plain path uses
+     */
+    for ( size_t b=0; b<N_BACKENDS; b++ )
+        if ( tlhash_set_hash ( backends[b] ) == TLHASH_SUCCESS )
+            run_lookups ( &symbols, backends[b] );
+    intern_finalize ( &pool );
+    return EXIT_SUCCESS;
+}
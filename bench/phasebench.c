@@ -0,0 +1,240 @@
+/* Time and memory of each phase of the compiler on the programs named
+ * on the command line, for instance ones written by vslgen. Every
+ * program is compiled ROUNDS times, phase by phase as vslc does it,
+ * with the listing going to /dev/null. Times are the best of the
+ * rounds; memory is the peak resident size after each phase of the
+ * first round, and what the tree arena holds.
+ *
+ *  phasebench [-r ROUNDS] [-j THREADS] program.vsl...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <vslc.h>
+
+typedef enum {
+    PHASE_SCAN,
+    PHASE_PARSE,
+    PHASE_SIMPLIFY,
+    PHASE_GLOBALS,
+    PHASE_BIND,
+    PHASE_PRINT,
+    PHASE_TEARDOWN,
+    N_PHASES
+} phase_t;
+
+static const char *phase_names[N_PHASES] = {
+    "scan", "parse (with scan)", "simplify_tree", "find_globals",
+    "bind_functions", "print", "teardown"
+};
+
+typedef struct {
+    double best[N_PHASES];
+    long peak_kb[N_PHASES];     /* After the phase, in the first round */
+    size_t arena_bytes[N_PHASES];
+    uint64_t n_tokens, n_nodes, n_strings;
+} measures_t;
+
+static int rounds = 5;
+static unsigned n_threads = 1;
+
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static long
+peak_kb ( void )
+{
+    struct rusage usage;
+    getrusage ( RUSAGE_SELF, &usage );
+    return usage.ru_maxrss;
+}
+
+
+static int
+count_node ( node_t **slot, uint64_t depth, void *context )
+{
+    if ( *slot != NULL )
+        *((uint64_t *) context) += 1;
+    return WALK_CONTINUE;
+}
+
+
+/* Starts a scanner on the mapped source, as vslc does for regular files */
+static void *
+start_scanner ( source_map_t *source )
+{
+    void *scanner;
+    if ( yylex_init ( &scanner ) != 0 )
+        return NULL;
+    yy_scan_buffer ( source->base, source->length + SOURCE_PADDING, scanner );
+    return scanner;
+}
+
+
+static void
+measure ( measures_t *m, int round, phase_t phase, double start, vslc_context_t *ctx )
+{
+    double elapsed = now ( ) - start;
+    if ( round == 0 || elapsed < m->best[phase] )
+        m->best[phase] = elapsed;
+    if ( round == 0 )
+    {
+        m->peak_kb[phase] = peak_kb ( );
+        m->arena_bytes[phase] = ( ctx != NULL ) ? ctx->tree_arena.n_bytes : 0;
+    }
+}
+
+
+/* One compilation, phase by phase. Returns nonzero if it did not parse. */
+static int
+compile ( const char *name, int null_fd, measures_t *m, int round )
+{
+    source_map_t source;
+    int fd = open ( name, O_RDONLY );
+    if ( fd < 0 || source_map ( &source, fd ) != SOURCE_SUCCESS )
+    {
+        fprintf ( stderr, "%s: cannot map it\n", name );
+        if ( fd >= 0 )
+            close ( fd );
+        return -1;
+    }
+    close ( fd );
+
+    /* Scanning alone, so that parsing can be told apart from it */
+    double start = now ( );
+    YYSTYPE value;
+    void *scanner = start_scanner ( &source );
+    m->n_tokens = 0;
+    while ( scanner != NULL && yylex ( &value, scanner ) != 0 )
+        m->n_tokens += 1;
+    yylex_destroy ( scanner );
+    measure ( m, round, PHASE_SCAN, start, NULL );
+
+    /* The scanner works in place, so it gets a fresh copy of the text */
+    source_unmap ( &source );
+    fd = open ( name, O_RDONLY );
+    if ( fd < 0 || source_map ( &source, fd ) != SOURCE_SUCCESS )
+    {
+        if ( fd >= 0 )
+            close ( fd );
+        return -1;
+    }
+    close ( fd );
+
+    vslc_context_t ctx;
+    if ( vslc_context_init ( &ctx, null_fd, name ) != CONTEXT_SUCCESS )
+    {
+        source_unmap ( &source );
+        return -1;
+    }
+    ctx.n_threads = n_threads;
+
+    start = now ( );
+    scanner = start_scanner ( &source );
+    int status = ( scanner != NULL ) ? yyparse ( &ctx, scanner ) : -1;
+    yylex_destroy ( scanner );
+    measure ( m, round, PHASE_PARSE, start, &ctx );
+    source_unmap ( &source );
+
+    if ( status == 0 )
+    {
+        start = now ( );
+        simplify_tree ( &ctx.root, ctx.root, &ctx.tree_arena );
+        measure ( m, round, PHASE_SIMPLIFY, start, &ctx );
+        m->n_nodes = 0;
+        tree_walk ( &ctx.root, count_node, NULL, &m->n_nodes );
+
+        start = now ( );
+        find_globals ( &ctx );
+        measure ( m, round, PHASE_GLOBALS, start, &ctx );
+
+        start = now ( );
+        bind_functions ( &ctx );
+        measure ( m, round, PHASE_BIND, start, &ctx );
+        m->n_strings = ctx.stringc;
+
+        start = now ( );
+        print_symbol_table ( &ctx );
+        measure ( m, round, PHASE_PRINT, start, &ctx );
+    }
+    else
+        fprintf ( stderr, "%s: does not parse\n", name );
+
+    start = now ( );
+    vslc_context_finalize ( &ctx );
+    measure ( m, round, PHASE_TEARDOWN, start, NULL );
+    return status;
+}
+
+
+static void
+report ( const char *name, measures_t *m )
+{
+    double total = 0.0;
+    for ( int p=0; p<N_PHASES; p++ )
+        if ( p != PHASE_SCAN )
+            total += m->best[p];
+    printf (
+        "%s: %lu tokens, %lu nodes after simplify_tree, %lu strings\n",
+        name, m->n_tokens, m->n_nodes, m->n_strings
+    );
+    printf ( "  %-20s %10s %6s %12s %12s\n", "phase", "ms", "%", "peak KiB", "arena KiB" );
+    for ( int p=0; p<N_PHASES; p++ )
+        printf (
+            "  %-20s %10.3f %5.1f%% %12ld %12zu\n", phase_names[p], m->best[p] * 1e3,
+            100.0 * m->best[p] / total, m->peak_kb[p], m->arena_bytes[p] / 1024
+        );
+    printf ( "  %-20s %10.3f\n", "total", total * 1e3 );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    int null_fd = open ( "/dev/null", O_WRONLY );
+    int status = EXIT_SUCCESS;
+    if ( null_fd < 0 )
+    {
+        perror ( "/dev/null" );
+        return EXIT_FAILURE;
+    }
+    for ( int i=1; i<argc; i++ )
+    {
+        if ( !strcmp ( argv[i], "-r" ) && i + 1 < argc )
+        {
+            if ( (rounds = atoi ( argv[++i] )) < 1 )
+                rounds = 1;
+            continue;
+        }
+        if ( !strcmp ( argv[i], "-j" ) && i + 1 < argc )
+        {
+            if ( (n_threads = strtoul ( argv[++i], NULL, 10 )) < 1 )
+                n_threads = 1;
+            continue;
+        }
+
+        measures_t m = { .n_tokens = 0 };
+        int failed = 0;
+        for ( int r=0; r<rounds && !failed; r++ )
+            failed = compile ( argv[i], null_fd, &m, r );
+        if ( failed )
+            status = EXIT_FAILURE;
+        else
+            report ( argv[i], &m );
+    }
+    close ( null_fd );
+    return status;
+}
@@ -0,0 +1,265 @@
+/* Writes a synthetic VSL program to stdout, for benchmarking the
+ * compiler on inputs of a chosen size and shape. Functions take
+ * parameters, declare locals, nest if/while blocks, call the functions
+ * before them and print strings; the same options and seed always give
+ * the same program.
+ *
+ *  -f N    functions (100)
+ *  -g N    global variables (4)
+ *  -p N    parameters per function (2)
+ *  -l N    locals per function (8)
+ *  -n N    statements per block (6)
+ *  -d N    nesting depth of blocks (3)
+ *  -e N    operators per expression (6)
+ *  -s N    string literals per function (4)
+ *  -r N    random seed (4205)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef struct {
+    int functions, globals, params, locals;
+    int statements, depth, operators, strings;
+    unsigned seed;
+} shape_t;
+
+/* Names in scope where code is being generated */
+typedef struct {
+    int function;               /* Index of the function, calls go below it */
+    int depth;                  /* Of the innermost block */
+    int strings_left;
+} place_t;
+
+static shape_t shape = {
+    .functions = 100, .globals = 4, .params = 2, .locals = 8,
+    .statements = 6, .depth = 3, .operators = 6, .strings = 4,
+    .seed = 4205
+};
+
+static const char *operators[] = { "+", "-", "*", "/", "&", "|", "^", "<<", ">>" };
+static const char *relations[] = { "=", "<", ">" };
+
+
+static void
+indent ( int depth )
+{
+    for ( int i=0; i<=depth; i++ )
+        fputs ( "    ", stdout );
+}
+
+
+/* Any variable visible in the innermost block */
+static void
+variable ( place_t *place )
+{
+    int n_names = shape.globals + shape.params + shape.locals + place->depth;
+    int pick = ( n_names > 0 ) ? rand() % n_names : -1;
+    if ( pick < 0 )
+        fputs ( "1", stdout );
+    else if ( pick < shape.globals )
+        printf ( "g%d", pick );
+    else if ( (pick -= shape.globals) < shape.params )
+        printf ( "a%d", pick );
+    else if ( (pick -= shape.params) < shape.locals )
+        printf ( "v%d", pick );
+    else
+        printf ( "t%d", pick - shape.locals + 1 );
+}
+
+
+static void
+leaf ( place_t *place )
+{
+    int kind = rand() % 8;
+    if ( kind == 0 && place->function > 0 )
+    {
+        printf ( "f%d (", rand() % place->function );
+        for ( int a=0; a<shape.params; a++ )
+        {
+            fputs ( ( a > 0 ) ? ", " : " ", stdout );
+            variable ( place );
+        }
+        fputs ( " )", stdout );
+    }
+    else if ( kind < 3 )
+        printf ( "%d", rand() % 1000 );
+    else
+        variable ( place );
+}
+
+
+/* An expression with n_operators binary operators, parenthesized */
+static void
+expression ( place_t *place, int n_operators )
+{
+    if ( n_operators == 0 )
+    {
+        leaf ( place );
+        return;
+    }
+    /* Divisors and shift counts are variables, so that no constant
+     * division by zero or out of range shift is left for folding
+     */
+    int operator = rand() % 9;
+    bool constant_right = ( operator != 3 && operator < 7 );
+    int left = constant_right ? rand() % n_operators : n_operators - 1;
+    fputs ( "(", stdout );
+    expression ( place, left );
+    printf ( " %s ", operators[operator] );
+    if ( constant_right )
+        expression ( place, n_operators - 1 - left );
+    else
+        variable ( place );
+    fputs ( ")", stdout );
+}
+
+
+static void
+relation ( place_t *place )
+{
+    expression ( place, shape.operators / 2 );
+    printf ( " %s ", relations[rand() % 3] );
+    expression ( place, shape.operators / 2 );
+}
+
+
+static void block ( place_t *place );
+
+
+static void
+statement ( place_t *place )
+{
+    int kind = rand() % 6;
+    if ( place->depth >= shape.depth && kind >= 3 )
+        kind = rand() % 3;
+    if ( kind < 2 && shape.globals + shape.params + shape.locals + place->depth == 0 )
+        kind = 2;
+    indent ( place->depth );
+    switch ( kind )
+    {
+        case 0:
+        case 1:
+            variable ( place );
+            fputs ( " := ", stdout );
+            expression ( place, shape.operators );
+            break;
+        case 2:
+            fputs ( "print ", stdout );
+            if ( place->strings_left > 0 )
+            {
+                printf ( "\"%d strings to go\", ", place->strings_left );
+                place->strings_left -= 1;
+            }
+            expression ( place, shape.operators );
+            break;
+        case 3:
+            fputs ( "if ", stdout );
+            relation ( place );
+            fputs ( " then ", stdout );
+            block ( place );
+            break;
+        case 4:
+            fputs ( "while ", stdout );
+            relation ( place );
+            fputs ( " do ", stdout );
+            block ( place );
+            break;
+        case 5:
+            block ( place );
+            break;
+    }
+    fputs ( "\n", stdout );
+}
+
+
+/* Nested blocks declare a local of their own, t1 at depth 1 and so on */
+static void
+block ( place_t *place )
+{
+    place->depth += 1;
+    puts ( "begin" );
+    indent ( place->depth );
+    printf ( "var t%d\n", place->depth );
+    for ( int s=0; s<shape.statements; s++ )
+        statement ( place );
+    place->depth -= 1;
+    indent ( place->depth );
+    fputs ( "end", stdout );
+}
+
+
+static void
+function ( int index )
+{
+    place_t place = { .function = index, .depth = 0, .strings_left = shape.strings };
+    printf ( "def f%d (", index );
+    for ( int a=0; a<shape.params; a++ )
+        printf ( "%sa%d", ( a > 0 ) ? ", " : " ", a );
+    puts ( " )\nbegin" );
+    if ( shape.locals > 0 )
+    {
+        indent ( 0 );
+        fputs ( "var", stdout );
+        for ( int l=0; l<shape.locals; l++ )
+            printf ( "%sv%d", ( l > 0 ) ? ", " : " ", l );
+        fputs ( "\n", stdout );
+    }
+    for ( int s=0; s<shape.statements; s++ )
+        statement ( &place );
+    while ( place.strings_left > 0 )
+    {
+        indent ( 0 );
+        printf ( "print \"%d strings to go\"\n", place.strings_left-- );
+    }
+    indent ( 0 );
+    fputs ( "return ", stdout );
+    expression ( &place, shape.operators );
+    puts ( "\nend\n" );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    for ( int i=1; i<argc; i++ )
+    {
+        int *option = NULL;
+        if ( strlen ( argv[i] ) == 2 && argv[i][0] == '-' && i + 1 < argc )
+            switch ( argv[i][1] )
+            {
+                case 'f': option = &shape.functions; break;
+                case 'g': option = &shape.globals; break;
+                case 'p': option = &shape.params; break;
+                case 'l': option = &shape.locals; break;
+                case 'n': option = &shape.statements; break;
+                case 'd': option = &shape.depth; break;
+                case 'e': option = &shape.operators; break;
+                case 's': option = &shape.strings; break;
+                case 'r': shape.seed = strtoul ( argv[++i], NULL, 10 ); continue;
+            }
+        if ( option == NULL )
+        {
+            fprintf ( stderr, "usage: %s [-f|-g|-p|-l|-n|-d|-e|-s|-r N]...\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+        *option = atoi ( argv[++i] );
+        if ( *option < 0 )
+            *option = 0;
+    }
+    if ( shape.statements < 1 )
+        shape.statements = 1;
+
+    srand ( shape.seed );
+    if ( shape.globals > 0 )
+    {
+        fputs ( "var", stdout );
+        for ( int g=0; g<shape.globals; g++ )
+            printf ( "%sg%d", ( g > 0 ) ? ", " : " ", g );
+        puts ( "\n" );
+    }
+    for ( int f=0; f<shape.functions; f++ )
+        function ( f );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+/* Region allocator: allocations are carved out of large chunks by
+ * bumping a pointer, and everything is released in one go.
+ */
+typedef struct ac {
+    struct ac *prev;
+    size_t size, used;
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *head;
+    size_t chunk_size;
+    size_t n_allocs, n_bytes;
+    void *last;
+} arena_t;
+
+int arena_init ( arena_t *arena, size_t chunk_size );
+void *arena_alloc ( arena_t *arena, size_t size );
+void *arena_grow ( arena_t *arena, void *ptr, size_t old_size, size_t new_size );
+char *arena_strdup ( arena_t *arena, const char *str );
+void arena_release ( arena_t *arena );
+
+#define ARENA_CHUNK_SIZE (64*1024)  /* Size of the first chunk */
+#define ARENA_CHUNK_MAX (16*1024*1024) /* Chunks stop doubling here */
+#define ARENA_ALIGN 16              /* Alignment of every allocation */
+
+#define ARENA_SUCCESS 0     /* Success */
+#define ARENA_ENOMEM 1      /* No memory available */
+#endif
@@ -0,0 +1,30 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+#include "vslc.h"
+
+/* Everything one compilation works on. Contexts share nothing, so
+ * separate programs can be compiled on separate threads.
+ */
+struct vslc_context {
+    node_t *root;               /* Syntax tree */
+    arena_t tree_arena;         /* Owns all syntax tree nodes and their data */
+    intern_pool_t identifiers;  /* One copy of every distinct identifier name */
+    tlhash_t *global_names;     /* Symbol table */
+    char **string_list;         /* List of strings in the source */
+    size_t n_string_list;       /* String list capacity (grows on demand) */
+    size_t stringc;             /* String count */
+    uint64_t func_count;        /* Sequence numbers of functions */
+    unsigned n_threads;         /* Threads to bind functions on */
+    writer_t out;               /* Where listings are printed */
+    const char *filename;       /* Input name for messages, NULL for stdin */
+    vslc_stats_t *stats;        /* Phase costs are counted here, if set */
+    tlhash_stats_t *scope_tables;   /* Binding's scope tables are summed here, if set */
+};
+
+int vslc_context_init ( vslc_context_t *ctx, int out_fd, const char *filename );
+int vslc_context_finalize ( vslc_context_t *ctx );
+
+#define CONTEXT_SUCCESS 0   /* Success */
+#define CONTEXT_ENOMEM 1    /* No memory available */
+#define CONTEXT_EIO 2       /* The listing could not be written */
+#endif
@@ -0,0 +1,66 @@
+#ifndef FLAT_H
+#define FLAT_H
+#include "vslc.h"
+
+/* Index-based syntax tree: all nodes sit in one array in pre-order, and
+ * each node's children are a run of 32-bit indices in a shared edge
+ * array. Numbers, operators and string indices are held in the node
+ * itself, so walking the tree touches two arrays instead of chasing
+ * node, child array and data pointers.
+ */
+typedef uint32_t flat_index_t;
+#define FLAT_NONE UINT32_MAX        /* Empty child slot / no parent */
+
+typedef struct {
+    uint8_t type;                   /* node_index_t */
+    uint8_t op;                     /* operator_t */
+    uint16_t flags;
+    uint32_t n_children;
+    uint32_t edges;                 /* Children are edges[edges..+n_children) */
+    flat_index_t parent;
+    union {
+        int64_t number;             /* NUMBER_DATA */
+        uint64_t string;            /* STRING_DATA, with FLAT_STRING_INDEX */
+        const char *text;           /* STRING_DATA, without */
+        ident_t *ident;             /* IDENTIFIER_DATA */
+    } data;
+} flat_node_t;
+
+#define FLAT_STRING_INDEX 1         /* data.string indexes the string table */
+
+typedef struct {
+    flat_node_t *nodes;
+    flat_index_t *edges;
+    symbol_t **entries;             /* Bound symbols by node, NULL if none are */
+    uint32_t n_nodes, max_nodes;
+    uint32_t n_edges, max_edges;
+} flat_tree_t;
+
+/* Callback for flat_walk, same conventions as walk_fn in tree.h */
+typedef int (*flat_walk_fn)(
+    flat_tree_t *tree, flat_index_t node, uint64_t depth, void *context
+);
+
+int flat_init ( flat_tree_t *tree, uint32_t n_nodes );
+int flat_from_tree ( flat_tree_t *tree, node_t *root, bool strings_indexed );
+int flat_walk (
+    flat_tree_t *tree, flat_index_t root,
+    flat_walk_fn pre, flat_walk_fn post, void *context
+);
+void flat_print (
+    writer_t *out, flat_tree_t *tree, flat_index_t root, int nesting
+);
+void flat_finalize ( flat_tree_t *tree );
+
+/* Passes ported from the node_t tree (ir.c) */
+void print_flat_bindings ( vslc_context_t *ctx, flat_tree_t *tree );
+
+/* The child slot i of node n, FLAT_NONE if it is empty */
+#define FLAT_CHILD(tree,n,i) ((tree)->edges[(tree)->nodes[n].edges + (i)])
+/* The whole tree, once converted */
+#define FLAT_ROOT 0
+
+#define FLAT_SUCCESS 0      /* Success */
+#define FLAT_ENOMEM 1       /* No memory available */
+#define FLAT_ETOOBIG 2      /* More nodes or edges than 32-bit indices reach */
+#endif
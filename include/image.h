@@ -0,0 +1,72 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+#include "vslc.h"
+
+/* Binary image of a compiled program: the simplified tree in flat
+ * form, the string table and the symbol tables. Everything is
+ * addressed by offsets from the start of the image or by indices, so
+ * a mapped image can be used as it lies. Integers are in the byte
+ * order of the machine that wrote it, which the header records.
+ *
+ *  header
+ *  nodes       image_node_t[nodes.count], pre-order as in flat.h
+ *  edges       uint32_t[edges.count], IMAGE_NONE for empty children
+ *  symbols     image_symbol_t[symbols.count], globals first
+ *  names       uint64_t[names.count], offsets of identifier texts
+ *  strings     uint64_t[strings.count], offsets of string table texts
+ *  texts       NUL-terminated
+ */
+#define IMAGE_MAGIC "VSLB"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u
+#define IMAGE_NONE UINT32_MAX
+
+typedef struct {
+    uint64_t offset, count;
+} image_section_t;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n_globals;         /* The first symbols are the globals */
+    uint64_t size;              /* Of the whole image */
+    image_section_t nodes, edges, symbols, names, strings;
+} image_header_t;
+
+typedef struct {
+    uint8_t type, op;
+    uint16_t flags;
+    uint32_t n_children;
+    uint32_t edges;             /* Children are edges[edges..+n_children) */
+    uint32_t symbol;            /* Bound symbol, IMAGE_NONE if none */
+    int64_t data;               /* Number, string index or name index */
+} image_node_t;
+
+typedef struct {
+    uint32_t name;              /* Index into names */
+    uint32_t type;              /* symtype_t */
+    uint64_t scope;             /* Declaring scope, GLOBAL_SCOPE for globals */
+    uint64_t seq, nparms;
+    uint32_t node;              /* Declaring node, IMAGE_NONE if unknown */
+    uint32_t n_locals;          /* Functions: their locals are */
+    uint64_t locals;            /*  symbols[locals..+n_locals) */
+} image_symbol_t;
+
+/* A validated image, mapped read-only */
+typedef struct {
+    const char *base;
+    size_t size;
+    const image_header_t *header;
+} image_t;
+
+int image_save ( vslc_context_t *ctx, int fd );
+int image_map ( image_t *image, int fd );
+int image_load ( vslc_context_t *ctx, image_t *image, flat_tree_t *tree );
+void image_unmap ( image_t *image );
+
+#define IMAGE_SUCCESS 0     /* Success */
+#define IMAGE_ENOMEM 1      /* No memory available */
+#define IMAGE_EIO 2         /* Reading, mapping or writing failed */
+#define IMAGE_EFORMAT 3     /* Not an image, or a damaged one */
+#endif
@@ -0,0 +1,28 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/* An interned identifier. Every distinct name is stored once, so two
+ * identifiers are the same name exactly when their handles are equal.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    char text[];
+} ident_t;
+
+typedef struct {
+    size_t n_slots, size;
+    ident_t **slots;
+    arena_t storage;
+} intern_pool_t;
+
+int intern_init ( intern_pool_t *pool, size_t n_slots );
+void intern_finalize ( intern_pool_t *pool );
+ident_t *intern ( intern_pool_t *pool, const char *text );
+
+#define INTERN_SUCCESS 0    /* Success */
+#define INTERN_ENOMEM 1     /* No memory available */
+#endif
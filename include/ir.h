@@ -2,10 +2,14 @@
 #define IR_H
 
 #define LOCALS_BUCKET_COUNT 64
+/* Per-compilation state, see context.h */
+typedef struct vslc_context vslc_context_t;
+
 /* This is the tree node structure */
 typedef struct n
 {
     node_index_t type;
+    operator_t op;
     void *data;
     struct s *entry;
     uint64_t n_children;
@@ -14,7 +18,8 @@ typedef struct n
 
 // Export the initializer function, it is needed by the parser
 void node_init(
-    node_t *nd, node_index_t type, void *data, uint64_t n_children, ...);
+    node_t *nd, arena_t *arena, node_index_t type, void *data,
+    uint64_t n_children, ...);
 
 typedef enum
 {
@@ -26,30 +31,85 @@ typedef enum
 
 typedef struct s
 {
-    char *name;
+    ident_t *name;
     symtype_t type;
     node_t *node;
     size_t seq;
     size_t nparms;
     tlhash_t *locals;
+    struct s *shadowed;
 } symbol_t;
 
-typedef struct ssi
+typedef struct
 {
-    struct ssi *enclosing;
     uint64_t value;
-    uint64_t depth;
+    size_t mark;
 } scope_frame;
 
-int bind_declarations(symbol_t *function, node_t *root, size_t *seq_num, scope_frame* scope_stack);
-void create_symbol_table(void);
-void print_symbol_table(void);
-void print_symbols(void);
-void print_bindings(node_t *root);
-void destroy_symbol_table(void);
-void find_globals(void);
-void bind_names(symbol_t *function, node_t *root);
+/* Symbol table key: the declaring scope and the interned name */
+#define GLOBAL_SCOPE 0
+typedef struct
+{
+    uint64_t scope;
+    ident_t *name;
+} symbol_key_t;
+
+typedef struct
+{
+    ident_t *name;
+    symbol_t *symbol;
+} scope_binding_t;
+
+typedef struct
+{
+    size_t n_slots, size;
+    scope_binding_t *slots;
+    size_t n_declared, max_declared;
+    symbol_t **declared;
+    uint64_t n_lookups, n_hits;     // One thread uses a table, so these are always kept
+} scope_table_t;
+
+/* What binding a function leaves behind to be merged in function order */
+typedef struct
+{
+    node_t **strings;   // STRING_DATA nodes, in the order they are met
+    size_t n_strings, max_strings;
+    FILE *out;          // Messages, while binding
+    char *messages;
+    size_t messages_size;
+    uint64_t n_lookups, n_inserts;  // Symbol table operations, for --stats
+    tlhash_stats_t names;           // The scope table's shape and use, for --table-stats
+} bind_result_t;
+
+typedef struct
+{
+    vslc_context_t *ctx;
+    symbol_t *function;
+    bind_result_t *result;
+    size_t seq_num;
+    uint64_t scope_id;
+    scope_table_t names;
+    scope_frame *scopes;
+    size_t n_scopes, max_scopes;
+} bind_state_t;
+
+int bind_declarations(symbol_t *function, node_t *root, bind_state_t *state);
+void create_symbol_table(vslc_context_t *ctx);
+void bind_functions(vslc_context_t *ctx);
+void print_symbol_table(vslc_context_t *ctx);
+void print_symbols(vslc_context_t *ctx);
+void print_bindings(vslc_context_t *ctx, node_t *root);
+void destroy_symbol_table(vslc_context_t *ctx);
+void find_globals(vslc_context_t *ctx);
+void bind_names(vslc_context_t *ctx, symbol_t *function, node_t *root, bind_result_t *result);
 void destroy_symtab(tlhash_t *symtab);
-void *get_id_key(scope_frame *scope, char *id);
-uint64_t get_key_length(scope_frame *scope, char *id);
+uint32_t make_symbol_key(symbol_key_t *key, uint64_t scope, ident_t *id);
+int declare_local(symbol_t *function, symbol_t *symbol, scope_frame *scope, scope_table_t *names);
+symbol_t *resolve_name(tlhash_t *globals, scope_table_t *names, ident_t *name);
+void scope_table_init(scope_table_t *names);
+void scope_table_finalize(scope_table_t *names);
+symbol_t *scope_table_lookup(scope_table_t *names, ident_t *name);
+void scope_table_declare(scope_table_t *names, symbol_t *symbol);
+void scope_table_leave(scope_table_t *names, size_t mark);
+void scope_table_stats(scope_table_t *names, tlhash_stats_t *stats);
 #endif
@@ -29,5 +29,25 @@ typedef enum {
     STRING_DATA
 } node_index_t;
 
+/* Operators of EXPRESSION and RELATION nodes */
+typedef enum {
+    OP_NONE,
+    OP_OR,
+    OP_XOR,
+    OP_AND,
+    OP_RSHIFT,
+    OP_LSHIFT,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_NOT,
+    OP_EQ,
+    OP_LT,
+    OP_GT
+} operator_t;
+
 extern char *node_string[25];
+extern char *operator_string[15];
 #endif
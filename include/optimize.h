@@ -0,0 +1,40 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+#include "vslc.h"
+
+/* Optimizations on the bound tree, run by -O after create_symbol_table.
+ * optimize inlines calls across the program, then runs the other passes
+ * over every function in turn; the passes keep the tree, its bindings
+ * and the functions' locals tables consistent, so that the listing and
+ * image describe the optimized program.
+ */
+void optimize ( vslc_context_t *ctx );
+void inline_calls ( vslc_context_t *ctx, symbol_t **functions, size_t n_functions );
+void eliminate_dead_code ( vslc_context_t *ctx, symbol_t *function );
+void eliminate_tail_calls ( vslc_context_t *ctx, symbol_t *function );
+void hoist_invariants ( vslc_context_t *ctx, symbol_t *function );
+void reduce_strength ( vslc_context_t *ctx, symbol_t *function );
+void eliminate_common_subexpressions ( vslc_context_t *ctx, symbol_t *function );
+
+/* Rough latencies in cycles on a current x86-64, that passes weigh the
+ * operators of an expression by
+ */
+#define COST_SIMPLE 1
+#define COST_MUL 3
+#define COST_DIV 20
+
+/* Helpers shared by the passes */
+node_t *make_empty_block ( arena_t *arena );
+node_t *make_declaring_block ( arena_t *arena, node_t *names, node_t *statements );
+int skip_expressions ( node_t **slot, uint64_t depth, void *context );
+node_t *make_list ( arena_t *arena, node_index_t type, uint64_t n );
+node_t *make_reference ( arena_t *arena, symbol_t *symbol );
+bool local_extent ( symbol_t *function, uint64_t *scope, size_t *seq );
+symbol_t *add_local (
+    vslc_context_t *ctx, symbol_t *function, const char *name, uint64_t scope, size_t seq
+);
+bool has_call ( node_t *expression );
+bool is_pure ( node_t *expression );
+bool is_trivial ( node_t *expression );
+bool always_returns ( node_t *statement );
+#endif
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <stddef.h>
+
+/* Runs task(i, arg) for every i in [0, n_tasks) on up to n_threads
+ * threads, the calling one included. Tasks are handed out one at a
+ * time in index order, so long and short tasks even out.
+ */
+typedef void (*parallel_task_fn) ( size_t index, void *arg );
+
+int parallel_for (
+    size_t n_tasks, unsigned n_threads, parallel_task_fn task, void *arg
+);
+unsigned parallel_cpus ( void );
+
+#define PARALLEL_SUCCESS 0  /* Success */
+#define PARALLEL_ETHREAD 1  /* No worker could be started (ran serially) */
+#endif
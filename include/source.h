@@ -0,0 +1,23 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+#include <stddef.h>
+
+/* A source file mapped into memory for the scanner to work on in
+ * place. The text is followed by SOURCE_PADDING NUL bytes, which is
+ * what yy_scan_buffer wants to find at the end of its buffer.
+ */
+typedef struct {
+    char *base;
+    size_t length;      /* Of the text, without padding */
+    size_t mapped;      /* Of the whole mapping */
+} source_map_t;
+
+int source_map ( source_map_t *map, int fd );
+void source_unmap ( source_map_t *map );
+
+#define SOURCE_PADDING 2
+
+#define SOURCE_SUCCESS 0    /* Success */
+#define SOURCE_ESTREAM 1    /* Not a regular file (or empty): read it as a stream */
+#define SOURCE_EMAP 2       /* The file could not be mapped */
+#endif
@@ -0,0 +1,43 @@
+#ifndef STATS_H
+#define STATS_H
+#include "vslc.h"
+
+/* What each phase of a compilation costs, for --stats. Compilations
+ * that do not ask for it have a NULL ctx->stats and pay nothing but the
+ * tests for it. Allocations are those made from the tree arena and the
+ * identifier pool, and are reported as such: symbols and their tables
+ * are malloc'd, and show only in the peak resident size. That is the
+ * process's, and so is CPU time when binding may run on several threads.
+ */
+typedef enum {
+    STATS_PARSE,
+    STATS_SIMPLIFY,
+    STATS_SYMBOLS,
+    STATS_OPTIMIZE,
+    STATS_PRINT,
+    STATS_TEARDOWN,
+    STATS_N_PHASES
+} stats_phase_t;
+
+typedef struct {
+    double wall, cpu;           /* Seconds */
+    uint64_t n_allocs, n_bytes;
+} stats_cost_t;
+
+typedef struct {
+    stats_cost_t phases[STATS_N_PHASES];
+    uint64_t nodes_parsed, nodes_simplified;
+    uint64_t n_lookups, n_inserts;  /* In the symbol and scope tables */
+    long peak_kb;
+    bool all_threads;           /* CPU time of the process, not the thread */
+    stats_cost_t start;         /* Of the running phase */
+} vslc_stats_t;
+
+void stats_init ( vslc_stats_t *stats, bool all_threads );
+void stats_start ( vslc_stats_t *stats, vslc_context_t *ctx );
+void stats_stop ( vslc_stats_t *stats, vslc_context_t *ctx, stats_phase_t phase );
+uint64_t stats_count_nodes ( node_t *root );
+void stats_report ( vslc_stats_t *stats, const char *name, int fd );
+void stats_report_tables ( vslc_context_t *ctx, int fd );
+void stats_add_table ( tlhash_stats_t *sum, tlhash_stats_t *stats );
+#endif
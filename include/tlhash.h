@@ -1,25 +1,93 @@
 #ifndef TLHASH_H
 #define TLHASH_H
 #include <stddef.h>
-typedef struct el {
-    void *key, *value;
-    size_t key_length;
-    struct el *next;
-} tlhash_element_t;
+#include <stdint.h>
+/* Keys up to this many bytes are stored inside the entry itself */
+#define TLHASH_INLINE_KEY 24
 
+/* Entries are kept densely in insertion order, which is also the order
+ * tlhash_keys and tlhash_values report them in.
+ */
 typedef struct {
-    size_t n_buckets, size;
-    tlhash_element_t **buckets;
+    uint32_t hash;
+    uint32_t key_length;
+    union {
+        unsigned char bytes[TLHASH_INLINE_KEY];
+        void *ptr;
+    } key;
+    void *value;
+} tlhash_entry_t;
+
+/* Open-addressed index into the entries, probed Robin Hood style.
+ * entry is an index into the entry array plus one, 0 marks a free slot.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t entry;
+} tlhash_slot_t;
+
+/* Lookup counts, kept only after tlhash_set_counting has turned them
+ * on. They are updated atomically, as tables may be read by several
+ * threads at once.
+ */
+typedef struct {
+    uint64_t n_lookups, n_hits;
+    uint64_t bytes_hashed;      /* Key bytes, hashed here or by the caller */
+} tlhash_counters_t;
+
+typedef struct {
+    size_t n_slots, size;
+    size_t n_entries, max_entries;
+    tlhash_slot_t *slots;
+    tlhash_entry_t *entries;
+    tlhash_counters_t counters;
 } tlhash_t;
 
+/* Shape of a table and how it has been used, from tlhash_stats. An
+ * entry's probe length is the number of slots a lookup for it visits;
+ * the last histogram bucket holds every longer one.
+ */
+#define TLHASH_PROBE_BUCKETS 8
+typedef struct {
+    size_t size, n_slots;
+    double load_factor;
+    size_t probe_lengths[TLHASH_PROBE_BUCKETS];
+    size_t max_probe_length;
+    double mean_probe_length;
+    int counted;                /* Whether the counters below were kept */
+    uint64_t n_lookups, n_hits, n_misses;
+    double mean_bytes_hashed;
+} tlhash_stats_t;
+
 int tlhash_init ( tlhash_t *tab, size_t n_buckets );
 int tlhash_finalize ( tlhash_t *tab );
 int tlhash_insert ( tlhash_t *tab, void *key, size_t keylen, void *val );
 int tlhash_lookup ( tlhash_t *tab, void *key, size_t keylen, void **val );
 int tlhash_remove ( tlhash_t *tab, void *key, size_t key_length );
+int tlhash_insert_hashed (
+    tlhash_t *tab, void *key, size_t keylen, uint32_t hash, void *val
+);
+int tlhash_lookup_hashed (
+    tlhash_t *tab, void *key, size_t keylen, uint32_t hash, void **val
+);
+int tlhash_remove_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash
+);
 size_t tlhash_size ( tlhash_t *tab );
+void tlhash_stats ( tlhash_t *tab, tlhash_stats_t *stats );
+void tlhash_set_counting ( int on );
 void tlhash_keys ( tlhash_t *tab, void **keys );
 void tlhash_values ( tlhash_t *tab, void **values );
+int tlhash_set_hash ( const char *name );
+const char *tlhash_hash_name ( void );
+uint32_t tlhash_hash ( const void *key, size_t key_length );
+
+/* Pointer sets, and maps from pointers to indices */
+#define NO_INDEX UINT32_MAX
+int in_set ( tlhash_t *set, const void *pointer );
+int add_to_set ( tlhash_t *set, const void *pointer );
+uint32_t lookup_index ( tlhash_t *map, const void *pointer );
+int store_index ( tlhash_t *map, const void *pointer, uint32_t index );
 
 #define TLHASH_SUCCESS 0    /* Success */
 #define TLHASH_ENOMEM 1     /* No memory available */
@@ -1,8 +1,16 @@
 #pragma once
 #include "vslc.h"
 
-void node_print(node_t *root, int nesting);
-void node_init(node_t *nd, node_index_t type, void *data, uint64_t n_children, ...);
-void node_finalize(node_t *discard);
-void destroy_subtree(node_t *discard);
-void simplify_tree(node_t **simplified, node_t *root);
+/* Callback for tree_walk, given the slot holding the node and its depth */
+typedef int (*walk_fn)(node_t **slot, uint64_t depth, void *context);
+#define WALK_CONTINUE 0             /* Visit all children */
+#define WALK_SKIP_CHILDREN INT_MAX  /* Visit none of the children */
+#define WALK_ABORT (-1)             /* Stop the walk */
+#define WALK_ENOMEM (-2)            /* Walk stack could not grow */
+
+int tree_walk(node_t **root, walk_fn pre, walk_fn post, void *context);
+void node_print(writer_t *out, node_t *root, int nesting);
+void node_init(node_t *nd, arena_t *arena, node_index_t type, void *data, uint64_t n_children, ...);
+void destroy_tree(vslc_context_t *ctx);
+void simplify_tree(node_t **simplified, node_t *root, arena_t *arena);
+void fold_tree(node_t **root);
@@ -5,19 +5,35 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <stdarg.h>
 
 #include "tlhash.h"
+#include "writer.h"
+#include "arena.h"
+#include "intern.h"
 #include "nodetypes.h"
 #include "ir.h"
 #include "y.tab.h"
 #include "tree.h"
+#include "flat.h"
+#include "stats.h"
+#include "context.h"
+#include "parallel.h"
+#include "source.h"
+#include "image.h"
+#include "optimize.h"
 
-int yyerror ( const char *error );
-extern int yylineno;
-extern int yylex ( void );
-extern char yytext[];
-
-extern node_t *root;
+/* The parser is pure and the scanner reentrant; their state is passed
+ * around as the flex yyscan_t handle.
+ */
+int yyerror ( vslc_context_t *ctx, void *scanner, const char *error );
+int yylex ( YYSTYPE *lvalp, void *scanner );
+int yylex_init ( void **scanner );
+int yylex_destroy ( void *scanner );
+void yyset_in ( FILE *in, void *scanner );
+struct yy_buffer_state *yy_scan_buffer ( char *base, size_t size, void *scanner );
+char *yyget_text ( void *scanner );
+int yyget_lineno ( void *scanner );
 
 #endif
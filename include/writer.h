@@ -0,0 +1,40 @@
+#ifndef WRITER_H
+#define WRITER_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Buffered output to a file descriptor. Text is collected in a private
+ * buffer and handed to write(2) a buffer at a time; integers are
+ * formatted by hand. Nothing is locked, so each thread needs a writer
+ * of its own.
+ */
+typedef struct {
+    int fd;
+    int error;          /* errno of the first failed write, 0 if none */
+    size_t used, size;
+    char *buffer;
+} writer_t;
+
+int writer_init ( writer_t *writer, int fd, size_t size );
+void writer_bytes ( writer_t *writer, const char *bytes, size_t length );
+void writer_string ( writer_t *writer, const char *string );
+void writer_uint ( writer_t *writer, uint64_t value );
+void writer_int ( writer_t *writer, int64_t value );
+void writer_pad ( writer_t *writer, char c, size_t count );
+int writer_flush ( writer_t *writer );
+int writer_finalize ( writer_t *writer );
+
+static inline void
+writer_char ( writer_t *writer, char c )
+{
+    if ( writer->used == writer->size )
+        writer_flush ( writer );
+    writer->buffer[writer->used++] = c;
+}
+
+#define WRITER_BUFFER_SIZE (64*1024)  /* Default buffer size */
+
+#define WRITER_SUCCESS 0    /* Success */
+#define WRITER_ENOMEM 1     /* No memory available */
+#define WRITER_EIO 2        /* A write failed, see writer->error */
+#endif
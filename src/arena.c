@@ -0,0 +1,154 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <arena.h>
+
+/* Chunk payload starts at the first aligned address after the header */
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN-1)) & ~((size_t)ARENA_ALIGN-1))
+#define CHUNK_HEADER ALIGN_UP(sizeof(arena_chunk_t))
+#define CHUNK_DATA(c) ((uint8_t *)(c) + CHUNK_HEADER)
+
+static arena_chunk_t *new_chunk ( size_t size );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Initializer - no memory is taken until the first allocation
+ * Returns
+ *  SUCCESS - always
+ */
+int
+arena_init ( arena_t *arena, size_t chunk_size )
+{
+    *arena = (arena_t) {
+        .head = NULL,
+        .chunk_size = (chunk_size > 0) ? chunk_size : ARENA_CHUNK_SIZE,
+        .n_allocs = 0,
+        .n_bytes = 0,
+        .last = NULL
+    };
+    return ARENA_SUCCESS;
+}
+
+
+/* Allocation - bump the pointer in the current chunk, start a new one
+ * when it runs out. Requests too large for a regular chunk get a chunk
+ * of their own, which is linked in behind the current one so that its
+ * free space is not abandoned.
+ * Returns NULL if size is 0 or no memory is available.
+ */
+void *
+arena_alloc ( arena_t *arena, size_t size )
+{
+    if ( size == 0 )
+        return NULL;
+    size = ALIGN_UP ( size );
+
+    arena_chunk_t *chunk = arena->head;
+    if ( chunk == NULL || chunk->size - chunk->used < size )
+    {
+        if ( size > arena->chunk_size / 4 && chunk != NULL )
+        {
+            arena_chunk_t *big = new_chunk ( size );
+            if ( big == NULL )
+                return NULL;
+            big->prev = chunk->prev;
+            chunk->prev = big;
+            big->used = size;
+            arena->n_allocs += 1;
+            arena->n_bytes += size;
+            return CHUNK_DATA(big);
+        }
+        size_t chunk_size = arena->chunk_size;
+        if ( arena->chunk_size < ARENA_CHUNK_MAX )
+            arena->chunk_size *= 2;
+        chunk = new_chunk ( (size > chunk_size) ? size : chunk_size );
+        if ( chunk == NULL )
+            return NULL;
+        chunk->prev = arena->head;
+        arena->head = chunk;
+    }
+
+    void *ptr = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+    arena->n_allocs += 1;
+    arena->n_bytes += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+
+/* Resize an allocation - extends in place when ptr is the most recent
+ * allocation and the chunk has room, copies otherwise. The old copy
+ * stays allocated until the arena is released.
+ */
+void *
+arena_grow ( arena_t *arena, void *ptr, size_t old_size, size_t new_size )
+{
+    arena_chunk_t *chunk = arena->head;
+    if ( ptr != NULL && ptr == arena->last )
+    {
+        size_t start = (uint8_t *)ptr - CHUNK_DATA(chunk);
+        if ( chunk->size - start >= ALIGN_UP(new_size) )
+        {
+            arena->n_bytes += ALIGN_UP(new_size) - (chunk->used - start);
+            chunk->used = start + ALIGN_UP(new_size);
+            return ptr;
+        }
+    }
+    void *copy = arena_alloc ( arena, new_size );
+    if ( copy != NULL && ptr != NULL )
+        memcpy ( copy, ptr, (old_size < new_size) ? old_size : new_size );
+    return copy;
+}
+
+
+char *
+arena_strdup ( arena_t *arena, const char *str )
+{
+    size_t length = strlen ( str ) + 1;
+    char *copy = arena_alloc ( arena, length );
+    if ( copy != NULL )
+        memcpy ( copy, str, length );
+    return copy;
+}
+
+
+/* Finalizer - frees every chunk, leaving an empty arena that can be
+ * allocated from again.
+ */
+void
+arena_release ( arena_t *arena )
+{
+    arena_chunk_t *chunk = arena->head;
+    while ( chunk != NULL )
+    {
+        arena_chunk_t *prev = chunk->prev;
+        free ( chunk );
+        chunk = prev;
+    }
+    arena->head = NULL;
+    arena->last = NULL;
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static arena_chunk_t *
+new_chunk ( size_t size )
+{
+    arena_chunk_t *chunk = malloc ( CHUNK_HEADER + size );
+    if ( chunk == NULL )
+        return NULL;
+    chunk->prev = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
@@ -0,0 +1,57 @@
+#include <vslc.h>
+
+
+/* Initializer - an empty compilation listing to out_fd
+ * Returns
+ *  SUCCESS - the context is ready for yyparse
+ *  ENOMEM - no memory available
+ */
+int
+vslc_context_init ( vslc_context_t *ctx, int out_fd, const char *filename )
+{
+    *ctx = (vslc_context_t) {
+        .root = NULL,
+        .global_names = NULL,
+        .n_string_list = 8,
+        .stringc = 0,
+        .func_count = 0,
+        .n_threads = 1,
+        .filename = filename,
+        .stats = NULL,
+        .scope_tables = NULL
+    };
+    arena_init ( &ctx->tree_arena, ARENA_CHUNK_SIZE );
+    if ( writer_init ( &ctx->out, out_fd, WRITER_BUFFER_SIZE ) != WRITER_SUCCESS )
+        return CONTEXT_ENOMEM;
+    ctx->string_list = malloc ( ctx->n_string_list * sizeof(char *) );
+    if ( ctx->string_list == NULL ||
+         intern_init ( &ctx->identifiers, 1024 ) != INTERN_SUCCESS )
+    {
+        free ( ctx->string_list );
+        writer_finalize ( &ctx->out );
+        return CONTEXT_ENOMEM;
+    }
+    return CONTEXT_SUCCESS;
+}
+
+
+/* Finalizer - flushes the listing and releases whatever the
+ * compilation left behind, also when it stopped half way
+ * Returns
+ *  SUCCESS - the whole listing was written
+ *  EIO - it was not, the writer's error says why
+ */
+int
+vslc_context_finalize ( vslc_context_t *ctx )
+{
+    // Symbols point into the tree, so they have to go first
+    if ( ctx->global_names != NULL )
+        destroy_symbol_table ( ctx );
+    free ( ctx->string_list );
+    ctx->string_list = NULL;
+    destroy_tree ( ctx );
+    intern_finalize ( &ctx->identifiers );
+    if ( writer_finalize ( &ctx->out ) != WRITER_SUCCESS )
+        return CONTEXT_EIO;
+    return CONTEXT_SUCCESS;
+}
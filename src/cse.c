@@ -0,0 +1,663 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Common subexpression elimination within runs of straight-line
+ * statements: assignments, prints and returns, and the condition of an
+ * if statement that ends them. Operands and operations are given value
+ * numbers by hashing what makes them up: an operation its operator and
+ * the numbers of its operands, a variable its symbol and the statement
+ * that last assigned it in the run, and a global also the number of
+ * statements with calls before it. An assignment or a call thus gives
+ * the expressions that depend on it new numbers, and expressions that
+ * call something are never numbered alike. Where an expression with a
+ * number is evaluated more than once, and the first evaluation is the
+ * whole value assigned to a local that keeps it long enough, the others
+ * use that local. Otherwise it is computed once into a temporary local
+ * before its first statement, if it costs more than using the local.
+ * Expressions that may trap are not moved ahead of a statement that has
+ * effects of its own, but may be kept from a later one. The largest
+ * repeated expressions are taken first; those that are evaluated once
+ * in the end are left alone.
+ */
+
+#define NONE SIZE_MAX
+
+/* Kinds of value keys other than operators */
+#define VALUE_NUMBER (-1)
+#define VALUE_LOCAL (-2)
+#define VALUE_GLOBAL (-3)       /* Less the number of calls seen */
+
+typedef struct {
+    int64_t kind;
+    uint64_t a, b;
+} value_key_t;
+
+typedef struct {
+    size_t number;
+    uint64_t size;              /* Nodes */
+    int cost;
+    bool calls, traps;
+} value_t;
+
+typedef enum { KEPT, FIRST, REPLACED, DEAD } state_t;
+
+/* An operation in the run */
+typedef struct {
+    node_t **slot;
+    size_t statement;           /* In the run */
+    size_t parent;              /* Operation it is an operand of */
+    value_t value;
+    state_t state;
+} occurrence_t;
+
+/* Occurrences in the order they are considered in */
+typedef struct {
+    uint64_t size;
+    size_t number, index;
+} rank_t;
+
+typedef struct {
+    size_t statement, order;
+    symbol_t *local;
+    node_t *assignment;
+} definition_t;
+
+/* An operation or call being numbered */
+typedef struct {
+    size_t index;               /* Of its occurrence, NONE for a call */
+    size_t values;              /* Values on the stack below its operands */
+} operation_t;
+
+typedef struct {
+    size_t next_assignment;     /* Statement that next assigns its variable */
+    bool effects;               /* Calls or prints */
+} statement_t;
+
+typedef struct {
+    vslc_context_t *ctx;
+    symbol_t *function;
+    uint64_t scope;             /* Largest scope value the function uses */
+    size_t seq;                 /* Number of the next local variable */
+    size_t n_common;            /* Names the temporaries */
+    tlhash_t *numbers;          /* Value keys to their numbers */
+    size_t n_numbers;
+    tlhash_t *variables;        /* Symbols to their index in versions */
+    uint64_t *versions;         /* Serial of the last assignment, plus one */
+    size_t n_variables, max_variables;
+    uint64_t serial;            /* Statements numbered before the run */
+    uint64_t n_calls;           /* Statements with calls numbered */
+    bool calls;                 /* Whether the statement at hand calls */
+    bool failed;
+    /* Of the expression at hand */
+    size_t statement;
+    value_t *values;            /* Of the operands numbered */
+    size_t n_values, max_values;
+    operation_t *open;          /* Operations entered and not yet numbered */
+    size_t n_open, max_open;
+    /* Of the run at hand */
+    node_t **run;
+    statement_t *statements;
+    size_t max_statements;
+    occurrence_t *occurrences;
+    size_t n_occurrences, max_occurrences;
+    definition_t *definitions;
+    size_t n_definitions, max_definitions;
+} eliminator_t;
+
+static int eliminate_in_list ( node_t **slot, uint64_t depth, void *context );
+static node_t *eliminate_in_run ( eliminator_t *e, node_t **run, size_t n );
+static void number_statement ( eliminator_t *e, size_t s );
+static void number ( eliminator_t *e, node_t **slot, size_t statement );
+static int number_operand ( node_t **slot, uint64_t depth, void *context );
+static int number_operation ( node_t **slot, uint64_t depth, void *context );
+static bool push_value ( eliminator_t *e, value_t value );
+static size_t number_variable ( eliminator_t *e, symbol_t *symbol );
+static void assign ( eliminator_t *e, symbol_t *symbol, size_t s );
+static size_t lookup ( eliminator_t *e, int64_t kind, uint64_t a, uint64_t b );
+static size_t version_index ( eliminator_t *e, symbol_t *symbol, bool add );
+static void reuse ( eliminator_t *e, rank_t *group, size_t n );
+static symbol_t *holder ( eliminator_t *e, occurrence_t *first, size_t last, bool *assigned );
+static node_t *wrap ( eliminator_t *e, size_t n );
+static bool is_straight ( node_t *statement );
+static int by_rank ( const void *a, const void *b );
+static int by_place ( const void *a, const void *b );
+static bool grow ( void **array, size_t *max, size_t n, size_t size );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+eliminate_common_subexpressions ( vslc_context_t *ctx, symbol_t *function )
+{
+    tlhash_t numbers, variables;
+    eliminator_t e = {
+        .ctx = ctx, .function = function, .numbers = &numbers, .variables = &variables
+    };
+    if ( !local_extent ( function, &e.scope, &e.seq ) )
+        return;
+    if ( tlhash_init ( &numbers, 64 ) != TLHASH_SUCCESS )
+        return;
+    if ( tlhash_init ( &variables, 16 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &numbers );
+        return;
+    }
+    tree_walk ( &function->node->children[2], skip_expressions, eliminate_in_list, &e );
+    tlhash_finalize ( &numbers );
+    tlhash_finalize ( &variables );
+    free ( e.versions );
+    free ( e.statements );
+    free ( e.occurrences );
+    free ( e.definitions );
+    free ( e.values );
+    free ( e.open );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Each run of the list that declares temporaries becomes a block */
+static int
+eliminate_in_list ( node_t **slot, uint64_t depth, void *context )
+{
+    eliminator_t *e = context;
+    node_t *list = *slot;
+    if ( list == NULL || list->type != STATEMENT_LIST )
+        return WALK_CONTINUE;
+
+    uint64_t s = 0;
+    while ( s < list->n_children )
+    {
+        uint64_t end = s;
+        while ( end < list->n_children && is_straight ( list->children[end] ) )
+            end += 1;
+        if ( end < list->n_children && list->children[end]->type == IF_STATEMENT )
+            end += 1;
+        if ( end == s )
+        {
+            s += 1;
+            continue;
+        }
+        node_t *block = eliminate_in_run ( e, &list->children[s], end - s );
+        if ( block == NULL )
+        {
+            s = end;
+            continue;
+        }
+        list->children[s] = block;
+        memmove (
+            &list->children[s + 1], &list->children[end],
+            (list->n_children - end) * sizeof(node_t *)
+        );
+        list->n_children -= end - s - 1;
+        s += 1;
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* Returns the block the run becomes, or NULL if it stays in place */
+static node_t *
+eliminate_in_run ( eliminator_t *e, node_t **run, size_t n )
+{
+    e->run = run;
+    e->n_occurrences = 0;
+    e->n_definitions = 0;
+    e->failed = !grow ( (void **) &e->statements, &e->max_statements, n, sizeof(statement_t) );
+    for ( size_t s=0; s<n && !e->failed; s++ )
+        number_statement ( e, s );
+    e->serial += n;
+    if ( e->failed || e->n_occurrences < 2 )
+        return NULL;
+
+    /* Largest first, and the occurrences of each value in order */
+    rank_t *ranks = malloc ( e->n_occurrences * sizeof(rank_t) );
+    if ( ranks == NULL )
+        return NULL;
+    size_t n_ranks = 0;
+    for ( size_t o=0; o<e->n_occurrences; o++ )
+    {
+        value_t *value = &e->occurrences[o].value;
+        if ( !value->calls )
+            ranks[n_ranks++] = (rank_t) { value->size, value->number, o };
+    }
+    qsort ( ranks, n_ranks, sizeof(rank_t), by_rank );
+    for ( size_t r=0, end; r<n_ranks; r=end )
+    {
+        for ( end=r+1; end<n_ranks && ranks[end].number == ranks[r].number; end++ )
+            ;
+        reuse ( e, &ranks[r], end - r );
+    }
+    free ( ranks );
+    return ( e->n_definitions > 0 ) ? wrap ( e, n ) : NULL;
+}
+
+
+static void
+number_statement ( eliminator_t *e, size_t s )
+{
+    /* An if's branches run after its condition, and are no part of the run */
+    node_t *statement = e->run[s];
+    e->calls = has_call ( ( statement->type == IF_STATEMENT ) ? statement->children[0] : statement );
+    e->statements[s] = (statement_t) {
+        .next_assignment = NONE,
+        .effects = e->calls || statement->type == PRINT_STATEMENT
+    };
+    switch ( statement->type )
+    {
+        case ASSIGNMENT_STATEMENT:
+            number ( e, &statement->children[1], s );
+            assign ( e, statement->children[0]->entry, s );
+            break;
+        case RETURN_STATEMENT:
+        case PRINT_STATEMENT:
+            for ( uint64_t c=0; c<statement->n_children; c++ )
+                if ( statement->children[c]->type != STRING_DATA )
+                    number ( e, &statement->children[c], s );
+            break;
+        case IF_STATEMENT:
+        {
+            node_t *relation = statement->children[0];
+            for ( uint64_t c=0; c<relation->n_children; c++ )
+                number ( e, &relation->children[c], s );
+            break;
+        }
+        default:
+            break;
+    }
+    if ( e->calls )
+        e->n_calls += 1;
+}
+
+
+/* Numbers the expression, recording its operations as occurrences */
+static void
+number ( eliminator_t *e, node_t **slot, size_t statement )
+{
+    e->statement = statement;
+    e->n_values = 0;
+    e->n_open = 0;
+    if ( tree_walk ( slot, number_operand, number_operation, e ) != 0 )
+        e->failed = true;
+}
+
+
+/* Numbers operands on the way down, and opens operations and calls */
+static int
+number_operand ( node_t **slot, uint64_t depth, void *context )
+{
+    eliminator_t *e = context;
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    size_t parent = ( e->n_open > 0 ) ? e->open[e->n_open-1].index : NONE;
+    value_t value = { .number = 0, .size = 1, .cost = 0, .calls = false, .traps = false };
+    switch ( node->type )
+    {
+        case NUMBER_DATA:
+            value.number = lookup ( e, VALUE_NUMBER, *((uint64_t *) node->data), 0 );
+            break;
+        case IDENTIFIER_DATA:
+            value.number = number_variable ( e, node->entry );
+            break;
+        case EXPRESSION_LIST:
+            return WALK_CONTINUE;
+        case EXPRESSION:
+            if ( !grow (
+                     (void **) &e->open, &e->max_open, e->n_open + 1, sizeof(operation_t) ) )
+                return WALK_ABORT;
+            if ( node->op == OP_NONE )
+            {
+                /* A call's value is new each time; its arguments are numbered on their own */
+                value.calls = true;
+                value.number = ++e->n_numbers;
+                if ( !push_value ( e, value ) )
+                    return WALK_ABORT;
+                e->open[e->n_open++] = (operation_t) { .index = NONE, .values = e->n_values };
+                return 1;
+            }
+            if ( !grow (
+                     (void **) &e->occurrences, &e->max_occurrences,
+                     e->n_occurrences + 1, sizeof(occurrence_t) ) )
+                return WALK_ABORT;
+            e->occurrences[e->n_occurrences] = (occurrence_t) {
+                .slot = slot, .statement = e->statement, .parent = parent, .state = KEPT
+            };
+            e->open[e->n_open++] = (operation_t) { .index = e->n_occurrences++, .values = e->n_values };
+            return WALK_CONTINUE;
+        default:
+            value.number = ++e->n_numbers;
+            break;
+    }
+    return push_value ( e, value ) ? WALK_SKIP_CHILDREN : WALK_ABORT;
+}
+
+
+/* Numbers an operation from the values of its operands on the way up */
+static int
+number_operation ( node_t **slot, uint64_t depth, void *context )
+{
+    eliminator_t *e = context;
+    node_t *node = *slot;
+    if ( node->type != EXPRESSION )
+        return WALK_CONTINUE;
+    operation_t operation = e->open[--e->n_open];
+    if ( operation.index == NONE )
+    {
+        /* The call's value is below its arguments' */
+        e->n_values = operation.values;
+        return WALK_CONTINUE;
+    }
+
+    value_t value = { .number = 0, .size = 1, .cost = 0, .calls = false, .traps = false };
+    size_t operands[2] = { 0, 0 };
+    for ( size_t c=0; operation.values + c < e->n_values && c<2; c++ )
+    {
+        value_t operand = e->values[operation.values + c];
+        operands[c] = operand.number;
+        value.size += operand.size;
+        value.cost += operand.cost;
+        value.calls |= operand.calls;
+        value.traps |= operand.traps;
+    }
+    e->n_values = operation.values;
+    value.cost += ( node->op == OP_MUL ) ? COST_MUL : ( node->op == OP_DIV ) ? COST_DIV : COST_SIMPLE;
+    if ( node->op == OP_DIV )
+    {
+        node_t *divisor = node->children[1];
+        value.traps |= divisor->type != NUMBER_DATA || *((int64_t *) divisor->data) == 0 ||
+            *((int64_t *) divisor->data) == -1;
+    }
+    if ( value.calls )
+        value.number = ++e->n_numbers;
+    else
+    {
+        switch ( node->op )
+        {
+            case OP_ADD: case OP_MUL: case OP_AND: case OP_OR: case OP_XOR:
+                if ( operands[0] > operands[1] )
+                {
+                    size_t swap = operands[0];
+                    operands[0] = operands[1];
+                    operands[1] = swap;
+                }
+                break;
+            default:
+                break;
+        }
+        value.number = lookup ( e, node->op, operands[0], operands[1] );
+    }
+    e->occurrences[operation.index].value = value;
+    return push_value ( e, value ) ? WALK_CONTINUE : WALK_ABORT;
+}
+
+
+static bool
+push_value ( eliminator_t *e, value_t value )
+{
+    if ( !grow ( (void **) &e->values, &e->max_values, e->n_values + 1, sizeof(value_t) ) )
+        return false;
+    e->values[e->n_values++] = value;
+    return true;
+}
+
+
+/* A global may change in any call, and in a statement that calls
+ * something, each use of one is taken to be different
+ */
+static size_t
+number_variable ( eliminator_t *e, symbol_t *symbol )
+{
+    if ( symbol == NULL || symbol->type == SYM_FUNCTION ||
+         (symbol->type == SYM_GLOBAL_VAR && e->calls) )
+        return ++e->n_numbers;
+    size_t index = version_index ( e, symbol, false );
+    uint64_t version = ( index != NONE ) ? e->versions[index] : 0;
+    if ( symbol->type == SYM_GLOBAL_VAR )
+        return lookup ( e, VALUE_GLOBAL - (int64_t) e->n_calls, (uintptr_t) symbol, version );
+    return lookup ( e, VALUE_LOCAL, (uintptr_t) symbol, version );
+}
+
+
+/* Gives the variable a new version, and links the statement that last
+ * assigned it in the run to this one
+ */
+static void
+assign ( eliminator_t *e, symbol_t *symbol, size_t s )
+{
+    if ( symbol == NULL )
+        return;
+    size_t index = version_index ( e, symbol, true );
+    if ( index == NONE )
+    {
+        e->failed = true;
+        return;
+    }
+    uint64_t last = e->versions[index];
+    if ( last > e->serial )
+        e->statements[last - 1 - e->serial].next_assignment = s;
+    e->versions[index] = e->serial + s + 1;
+}
+
+
+/* The value number of a key, a new one if it has none yet */
+static size_t
+lookup ( eliminator_t *e, int64_t kind, uint64_t a, uint64_t b )
+{
+    value_key_t key = { kind, a, b };
+    void *number;
+    if ( tlhash_lookup ( e->numbers, &key, sizeof(key), &number ) == TLHASH_SUCCESS )
+        return (uintptr_t) number;
+    e->n_numbers += 1;
+    if ( tlhash_insert ( e->numbers, &key, sizeof(key), (void *) (uintptr_t) e->n_numbers ) != TLHASH_SUCCESS )
+        e->failed = true;
+    return e->n_numbers;
+}
+
+
+/* Where the version of the variable is kept, NONE if it has none */
+static size_t
+version_index ( eliminator_t *e, symbol_t *symbol, bool add )
+{
+    void *index;
+    if ( tlhash_lookup ( e->variables, &symbol, sizeof(symbol), &index ) == TLHASH_SUCCESS )
+        return (uintptr_t) index - 1;
+    if ( !add || !grow (
+             (void **) &e->versions, &e->max_variables, e->n_variables + 1, sizeof(uint64_t) ) )
+        return NONE;
+    index = (void *) (uintptr_t) (e->n_variables + 1);
+    if ( tlhash_insert ( e->variables, &symbol, sizeof(symbol), index ) != TLHASH_SUCCESS )
+        return NONE;
+    e->versions[e->n_variables] = 0;
+    return e->n_variables++;
+}
+
+
+/* The occurrences of a value that are evaluated are those not inside an
+ * operation that is replaced; with two or more, the first is kept in a
+ * local and the others use it. One that may trap is not kept from a
+ * statement with effects, but may be from a later one.
+ */
+static void
+reuse ( eliminator_t *e, rank_t *group, size_t n )
+{
+    occurrence_t *first = NULL;
+    size_t start = 0, n_live = 0, last = 0;
+    for ( size_t g=0; g<n; g++ )
+    {
+        occurrence_t *occurrence = &e->occurrences[group[g].index];
+        if ( occurrence->parent != NONE &&
+             (e->occurrences[occurrence->parent].state == REPLACED ||
+              e->occurrences[occurrence->parent].state == DEAD) )
+        {
+            occurrence->state = DEAD;
+            continue;
+        }
+        if ( first == NULL && occurrence->value.traps &&
+             e->statements[occurrence->statement].effects )
+            continue;
+        if ( first == NULL )
+        {
+            first = occurrence;
+            start = g;
+        }
+        n_live += 1;
+        last = occurrence->statement;
+    }
+    if ( n_live < 2 )
+        return;
+
+    bool assigned;
+    symbol_t *local = holder ( e, first, last, &assigned );
+    if ( local == NULL )
+        return;
+    arena_t *arena = &e->ctx->tree_arena;
+    if ( !assigned )
+    {
+        node_t *assignment = arena_alloc ( arena, sizeof(node_t) );
+        node_init (
+            assignment, arena, ASSIGNMENT_STATEMENT, NULL, 2, make_reference ( arena, local ), *first->slot
+        );
+        e->definitions[e->n_definitions] = (definition_t) {
+            .statement = first->statement, .order = e->n_definitions, .local = local,
+            .assignment = assignment
+        };
+        e->n_definitions += 1;
+        *first->slot = make_reference ( arena, local );
+    }
+    first->state = FIRST;
+    for ( size_t g=start+1; g<n; g++ )
+    {
+        occurrence_t *occurrence = &e->occurrences[group[g].index];
+        if ( occurrence->state == DEAD )
+            continue;
+        *occurrence->slot = make_reference ( arena, local );
+        occurrence->state = REPLACED;
+    }
+}
+
+
+/* The local to keep the first occurrence's value in, up to the
+ * statement of the last: the variable it is assigned to, if that is a
+ * local not assigned again before, or else a new temporary, if the
+ * expression is worth one and may be evaluated ahead of its statement.
+ * assigned tells which it is; NULL if there is none.
+ */
+static symbol_t *
+holder ( eliminator_t *e, occurrence_t *first, size_t last, bool *assigned )
+{
+    node_t *statement = e->run[first->statement];
+    *assigned = statement->type == ASSIGNMENT_STATEMENT && first->slot == &statement->children[1];
+    if ( *assigned )
+    {
+        symbol_t *variable = statement->children[0]->entry;
+        if ( variable != NULL &&
+             (variable->type == SYM_LOCAL_VAR || variable->type == SYM_PARAMETER) &&
+             e->statements[first->statement].next_assignment >= last )
+            return variable;
+        *assigned = false;
+    }
+    if ( first->value.cost <= COST_SIMPLE )
+        return NULL;
+    if ( !grow (
+             (void **) &e->definitions, &e->max_definitions,
+             e->n_definitions + 1, sizeof(definition_t) ) )
+        return NULL;
+
+    /* The temporaries of a run are declared in a block of their own */
+    if ( e->n_definitions == 0 )
+        e->scope += 1;
+    char name[32];
+    snprintf ( name, sizeof(name), "common.%zu", e->n_common );
+    symbol_t *local = add_local ( e->ctx, e->function, name, e->scope, e->seq );
+    if ( local == NULL )
+        return NULL;
+    e->n_common += 1;
+    e->seq += 1;
+    return local;
+}
+
+
+/* begin var common.n, ... common.n := expression ... run end, where
+ * each temporary is assigned before the statement that first uses it,
+ * and after those it is computed from
+ */
+static node_t *
+wrap ( eliminator_t *e, size_t n )
+{
+    arena_t *arena = &e->ctx->tree_arena;
+    node_t *names = make_list ( arena, VARIABLE_LIST, e->n_definitions );
+    for ( size_t d=0; d<e->n_definitions; d++ )
+        names->children[names->n_children++] = e->definitions[d].local->node;
+
+    qsort ( e->definitions, e->n_definitions, sizeof(definition_t), by_place );
+    node_t *statements = make_list ( arena, STATEMENT_LIST, n + e->n_definitions );
+    size_t d = 0;
+    for ( size_t s=0; s<n; s++ )
+    {
+        for ( ; d<e->n_definitions && e->definitions[d].statement == s; d++ )
+            statements->children[statements->n_children++] = e->definitions[d].assignment;
+        statements->children[statements->n_children++] = e->run[s];
+    }
+
+    return make_declaring_block ( arena, names, statements );
+}
+
+
+/* Statements control goes through to the next one after, if at all */
+static bool
+is_straight ( node_t *statement )
+{
+    return statement->type == ASSIGNMENT_STATEMENT || statement->type == PRINT_STATEMENT ||
+        statement->type == RETURN_STATEMENT;
+}
+
+
+/* Larger values first, then by number, then in the order they occur */
+static int
+by_rank ( const void *a, const void *b )
+{
+    const rank_t *x = a, *y = b;
+    if ( x->size != y->size )
+        return ( x->size > y->size ) ? -1 : 1;
+    if ( x->number != y->number )
+        return ( x->number < y->number ) ? -1 : 1;
+    return ( x->index < y->index ) ? -1 : ( x->index > y->index );
+}
+
+
+/* By statement, and before a statement, those made later first: an
+ * expression is made into a temporary before the ones inside it
+ */
+static int
+by_place ( const void *a, const void *b )
+{
+    const definition_t *x = a, *y = b;
+    if ( x->statement != y->statement )
+        return ( x->statement < y->statement ) ? -1 : 1;
+    return ( x->order > y->order ) ? -1 : ( x->order < y->order );
+}
+
+
+/* Makes room for n elements in a malloc'ed array */
+static bool
+grow ( void **array, size_t *max, size_t n, size_t size )
+{
+    if ( n <= *max )
+        return true;
+    size_t new_max = ( *max > 0 ) ? 2 * *max : 16;
+    while ( new_max < n )
+        new_max *= 2;
+    void *grown = realloc ( *array, new_max * size );
+    if ( grown == NULL )
+        return false;
+    *array = grown;
+    *max = new_max;
+    return true;
+}
@@ -0,0 +1,330 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Dead code elimination: if statements with a constant condition give
+ * way to the branch taken, while loops that never run and statements
+ * after one that always returns are dropped. Locals that were referred
+ * to or declared only in dropped statements are then taken out of the
+ * function's table and their declarations, and the remaining locals
+ * renumbered; other locals are left as they are.
+ */
+
+typedef struct {
+    arena_t *arena;
+    tlhash_t *nodes;            /* Declaring nodes of dropped locals */
+    tlhash_t *symbols;          /* Locals still referred to */
+    tlhash_t *dropped;          /* Locals and declaring nodes in dropped code */
+    tlhash_t *returning;        /* Statements kept that always return */
+} prune_t;
+
+static int prune_statement ( node_t **slot, uint64_t depth, void *context );
+static int returns ( prune_t *prune, node_t *statement );
+static void drop ( prune_t *prune, node_t *statement );
+static int mark_dropped ( node_t **slot, uint64_t depth, void *context );
+static int mark_used ( node_t **slot, uint64_t depth, void *context );
+static int drop_declarations ( node_t **slot, uint64_t depth, void *context );
+static void drop_unused_locals ( symbol_t *function, prune_t *prune );
+static void compact ( node_t *list );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+eliminate_dead_code ( vslc_context_t *ctx, symbol_t *function )
+{
+    tlhash_t nodes, symbols, dropped, returning;
+    prune_t prune = {
+        .arena = &ctx->tree_arena, .nodes = &nodes, .symbols = &symbols,
+        .dropped = &dropped, .returning = &returning
+    };
+    if ( tlhash_init ( &nodes, 16 ) != TLHASH_SUCCESS )
+        return;
+    if ( tlhash_init ( &symbols, 64 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &nodes );
+        return;
+    }
+    if ( tlhash_init ( &dropped, 16 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &nodes );
+        tlhash_finalize ( &symbols );
+        return;
+    }
+    if ( tlhash_init ( &returning, 16 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &nodes );
+        tlhash_finalize ( &symbols );
+        tlhash_finalize ( &dropped );
+        return;
+    }
+
+    node_t **body = &function->node->children[2];
+    tree_walk ( body, skip_expressions, prune_statement, &prune );
+    if ( *body == NULL )
+        *body = make_empty_block ( prune.arena );
+
+    if ( tlhash_size ( &dropped ) > 0 )
+    {
+        tree_walk ( body, mark_used, NULL, &prune );
+        drop_unused_locals ( function, &prune );
+        if ( tlhash_size ( &nodes ) > 0 )
+            tree_walk ( body, NULL, drop_declarations, &prune );
+    }
+
+    tlhash_finalize ( &nodes );
+    tlhash_finalize ( &symbols );
+    tlhash_finalize ( &dropped );
+    tlhash_finalize ( &returning );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Statements are pruned after their substatements; a statement that
+ * is dropped leaves NULL in its slot, for its parent to deal with.
+ * Whether a statement always returns is found from its substatements
+ * here too, as always_returns would, without going down again.
+ */
+static int
+prune_statement ( node_t **slot, uint64_t depth, void *context )
+{
+    prune_t *prune = context;
+    node_t *node = *slot;
+    switch ( node->type )
+    {
+        case IF_STATEMENT:
+        {
+            node_t *condition = node->children[0];
+            node_t *otherwise = ( node->n_children > 2 ) ? node->children[2] : NULL;
+            if ( condition->type == NUMBER_DATA )
+            {
+                bool taken = *((int64_t *) condition->data) != 0;
+                drop ( prune, taken ? otherwise : node->children[1] );
+                *slot = taken ? node->children[1] : otherwise;
+            }
+            else if ( node->children[1] == NULL && otherwise == NULL && is_pure ( condition ) )
+            {
+                drop ( prune, condition );
+                *slot = NULL;
+            }
+            else
+            {
+                if ( node->children[1] == NULL )
+                    node->children[1] = make_empty_block ( prune->arena );
+                if ( node->n_children > 2 && otherwise == NULL )
+                    node->n_children = 2;
+                if ( node->n_children > 2 && in_set ( prune->returning, node->children[1] ) &&
+                     in_set ( prune->returning, node->children[2] ) )
+                    return returns ( prune, node );
+            }
+            break;
+        }
+        case WHILE_STATEMENT:
+        {
+            node_t *condition = node->children[0];
+            if ( condition->type == NUMBER_DATA && *((int64_t *) condition->data) == 0 )
+            {
+                drop ( prune, node );
+                *slot = NULL;
+            }
+            else if ( node->children[1] == NULL )
+                node->children[1] = make_empty_block ( prune->arena );
+            break;
+        }
+        case STATEMENT_LIST:
+            compact ( node );
+            for ( uint64_t s=0; s<node->n_children; s++ )
+                if ( in_set ( prune->returning, node->children[s] ) )
+                {
+                    for ( uint64_t d=s+1; d<node->n_children; d++ )
+                        drop ( prune, node->children[d] );
+                    node->n_children = s + 1;
+                }
+            break;
+        case BLOCK:
+        {
+            /* A block with nothing left to do goes, declarations and all */
+            node_t *statements = node->children[node->n_children - 1];
+            if ( statements == NULL || statements->n_children == 0 )
+            {
+                drop ( prune, node );
+                *slot = NULL;
+            }
+            else if ( in_set ( prune->returning, statements->children[statements->n_children - 1] ) )
+                return returns ( prune, node );
+            break;
+        }
+        case RETURN_STATEMENT:
+            return returns ( prune, node );
+        default:
+            break;
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* A statement left unmarked only keeps what follows it, so the walk
+ * goes on if the set cannot grow
+ */
+static int
+returns ( prune_t *prune, node_t *statement )
+{
+    add_to_set ( prune->returning, statement );
+    return WALK_CONTINUE;
+}
+
+
+/* Remembers the locals that dropped code refers to or declares, as the
+ * only ones the pass may leave unused
+ */
+static void
+drop ( prune_t *prune, node_t *statement )
+{
+    if ( statement != NULL )
+        tree_walk ( &statement, mark_dropped, NULL, prune );
+}
+
+
+static int
+mark_dropped ( node_t **slot, uint64_t depth, void *context )
+{
+    prune_t *prune = context;
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    if ( node->type == DECLARATION )
+    {
+        node_t *names = node->children[0];
+        for ( uint64_t n=0; n<names->n_children; n++ )
+            add_to_set ( prune->dropped, names->children[n] );
+        return WALK_SKIP_CHILDREN;
+    }
+    if ( node->type == IDENTIFIER_DATA && node->entry != NULL &&
+         node->entry->type == SYM_LOCAL_VAR )
+        add_to_set ( prune->dropped, node->entry );
+    return WALK_CONTINUE;
+}
+
+
+static int
+mark_used ( node_t **slot, uint64_t depth, void *context )
+{
+    prune_t *prune = context;
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    if ( node->type == DECLARATION )
+        return WALK_SKIP_CHILDREN;
+    if ( node->type == IDENTIFIER_DATA && node->entry != NULL &&
+         node->entry->type == SYM_LOCAL_VAR )
+        add_to_set ( prune->symbols, node->entry );
+    return WALK_CONTINUE;
+}
+
+
+/* Takes the locals that dropped code left unreferenced out of the
+ * table, remembering where they were declared, and if there are any,
+ * numbers the rest from 0 in declaration order
+ */
+static void
+drop_unused_locals ( symbol_t *function, prune_t *prune )
+{
+    size_t n_locals = tlhash_size ( function->locals );
+    symbol_t **locals = malloc ( (n_locals + 1) * sizeof(symbol_t *) );
+    symbol_key_t **keys = malloc ( (n_locals + 1) * sizeof(symbol_key_t *) );
+    symbol_key_t *dropped = malloc ( (n_locals + 1) * sizeof(symbol_key_t) );
+    if ( locals == NULL || keys == NULL || dropped == NULL )
+    {
+        free ( locals );
+        free ( keys );
+        free ( dropped );
+        return;
+    }
+    tlhash_values ( function->locals, (void **)locals );
+    tlhash_keys ( function->locals, (void **)keys );
+
+    /* Keys point into the table, so they are copied before removals */
+    size_t n_dropped = 0, seq = 0;
+    for ( size_t l=0; l<n_locals; l++ )
+    {
+        symbol_t *local = locals[l];
+        if ( local->type != SYM_LOCAL_VAR || in_set ( prune->symbols, local ) ||
+             !(in_set ( prune->dropped, local ) || in_set ( prune->dropped, local->node )) )
+            continue;
+        if ( add_to_set ( prune->nodes, local->node ) == TLHASH_SUCCESS )
+        {
+            dropped[n_dropped++] = *keys[l];
+            locals[l] = NULL;
+            free ( local );
+        }
+    }
+    for ( size_t l=0; n_dropped > 0 && l<n_locals; l++ )
+        if ( locals[l] != NULL && locals[l]->type == SYM_LOCAL_VAR )
+            locals[l]->seq = seq++;
+    for ( size_t d=0; d<n_dropped; d++ )
+    {
+        symbol_key_t key;
+        uint32_t hash = make_symbol_key ( &key, dropped[d].scope, dropped[d].name );
+        tlhash_remove_hashed ( function->locals, &key, sizeof(key), hash );
+    }
+    free ( locals );
+    free ( keys );
+    free ( dropped );
+}
+
+
+/* Declarations lose the names of dropped locals, and go when they have
+ * none left; so do declaration lists
+ */
+static int
+drop_declarations ( node_t **slot, uint64_t depth, void *context )
+{
+    prune_t *prune = context;
+    node_t *node = *slot;
+    switch ( node->type )
+    {
+        case DECLARATION:
+        {
+            node_t *names = node->children[0];
+            uint64_t kept = 0;
+            for ( uint64_t n=0; n<names->n_children; n++ )
+                if ( !in_set ( prune->nodes, names->children[n] ) )
+                    names->children[kept++] = names->children[n];
+            names->n_children = kept;
+            if ( kept == 0 )
+                *slot = NULL;
+            break;
+        }
+        case DECLARATION_LIST:
+            compact ( node );
+            break;
+        case BLOCK:
+            if ( node->n_children == 2 && node->children[0]->n_children == 0 )
+            {
+                node->children[0] = node->children[1];
+                node->n_children = 1;
+            }
+            break;
+        default:
+            break;
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* Closes the gaps dropped children left in a list */
+static void
+compact ( node_t *list )
+{
+    uint64_t kept = 0;
+    for ( uint64_t c=0; c<list->n_children; c++ )
+        if ( list->children[c] != NULL )
+            list->children[kept++] = list->children[c];
+    list->n_children = kept;
+}
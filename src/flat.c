@@ -0,0 +1,383 @@
+#include <vslc.h>
+
+
+/* State of a conversion from node_t: the node open at each depth, and
+ * the next of its edges to fill in.
+ */
+typedef struct {
+    flat_tree_t *tree;
+    bool strings_indexed;
+    int status;
+    flat_index_t *open;
+    uint32_t *cursor;
+    uint64_t max_depth;
+} convert_t;
+
+typedef struct {
+    flat_index_t node;
+    uint32_t next_child;
+} flat_frame_t;
+
+#define NOT_ENTERED UINT32_MAX
+
+static int convert_node ( node_t **slot, uint64_t depth, void *context );
+static int reserve ( flat_tree_t *tree, uint32_t n_nodes, uint32_t n_edges );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Initializer - room for n_nodes nodes to begin with, the arrays grow
+ * as needed.
+ * Returns
+ *  SUCCESS - the tree is empty and ready for flat_from_tree
+ *  ENOMEM - no memory available
+ */
+int
+flat_init ( flat_tree_t *tree, uint32_t n_nodes )
+{
+    if ( n_nodes == 0 )
+        n_nodes = 64;
+    *tree = (flat_tree_t) {
+        .nodes = malloc ( n_nodes * sizeof(flat_node_t) ),
+        .edges = malloc ( n_nodes * sizeof(flat_index_t) ),
+        .entries = NULL,
+        .n_nodes = 0, .max_nodes = n_nodes,
+        .n_edges = 0, .max_edges = n_nodes
+    };
+    if ( tree->nodes == NULL || tree->edges == NULL )
+    {
+        flat_finalize ( tree );
+        return FLAT_ENOMEM;
+    }
+    return FLAT_SUCCESS;
+}
+
+
+/* Conversion - appends the tree under root in pre-order, so that root
+ * becomes FLAT_ROOT of an empty flat tree. Bound symbols are carried
+ * over into tree->entries. strings_indexed tells whether STRING_DATA
+ * nodes have had their text moved into the string table already.
+ * Returns
+ *  SUCCESS - the tree is converted
+ *  ENOMEM - no memory available
+ *  ETOOBIG - the tree does not fit 32-bit indices
+ */
+int
+flat_from_tree ( flat_tree_t *tree, node_t *root, bool strings_indexed )
+{
+    convert_t state = {
+        .tree = tree,
+        .strings_indexed = strings_indexed,
+        .status = FLAT_SUCCESS,
+        .max_depth = 64
+    };
+    state.open = malloc ( state.max_depth * sizeof(flat_index_t) );
+    state.cursor = malloc ( state.max_depth * sizeof(uint32_t) );
+    if ( state.open == NULL || state.cursor == NULL )
+        state.status = FLAT_ENOMEM;
+    else if ( tree_walk ( &root, convert_node, NULL, &state ) == WALK_ENOMEM )
+        state.status = FLAT_ENOMEM;
+    free ( state.open );
+    free ( state.cursor );
+    return state.status;
+}
+
+
+/* Depth-first traversal with the same callback conventions as
+ * tree_walk, except that post cannot replace nodes. Empty child slots
+ * are reported to pre as FLAT_NONE.
+ * Returns 0, a callback's negative value, or WALK_ENOMEM.
+ */
+int
+flat_walk (
+    flat_tree_t *tree, flat_index_t root,
+    flat_walk_fn pre, flat_walk_fn post, void *context
+) {
+    size_t n_frames = 1, max_frames = 64;
+    flat_frame_t *frames = malloc ( max_frames * sizeof(flat_frame_t) );
+    if ( frames == NULL )
+        return WALK_ENOMEM;
+    frames[0] = (flat_frame_t) { .node = root, .next_child = NOT_ENTERED };
+
+    int result = 0;
+    while ( n_frames > 0 )
+    {
+        flat_frame_t *frame = &frames[n_frames-1];
+        uint64_t depth = n_frames - 1;
+
+        if ( frame->next_child == NOT_ENTERED )
+        {
+            int skip = 0;
+            if ( pre != NULL &&
+                (skip = pre ( tree, frame->node, depth, context )) < 0
+            ) {
+                result = skip;
+                break;
+            }
+            if ( frame->node == FLAT_NONE )
+            {
+                n_frames -= 1;
+                continue;
+            }
+            frame->next_child = (uint32_t) skip;
+        }
+
+        flat_node_t *node = &tree->nodes[frame->node];
+        if ( frame->next_child < node->n_children )
+        {
+            flat_index_t child = tree->edges[node->edges + frame->next_child++];
+            if ( n_frames == max_frames )
+            {
+                flat_frame_t *grown = realloc (
+                    frames, 2 * max_frames * sizeof(flat_frame_t)
+                );
+                if ( grown == NULL )
+                {
+                    result = WALK_ENOMEM;
+                    break;
+                }
+                frames = grown;
+                max_frames *= 2;
+            }
+            frames[n_frames++] = (flat_frame_t) {
+                .node = child, .next_child = NOT_ENTERED
+            };
+        }
+        else
+        {
+            if ( post != NULL &&
+                (result = post ( tree, frame->node, depth, context )) < 0
+            )
+                break;
+            result = 0;
+            n_frames -= 1;
+        }
+    }
+
+    free ( frames );
+    return result;
+}
+
+
+typedef struct {
+    writer_t *out;
+    int nesting;
+} print_state_t;
+
+
+static int
+print_flat_node ( flat_tree_t *tree, flat_index_t n, uint64_t depth, void *context )
+{
+    print_state_t *state = context;
+    writer_t *out = state->out;
+    uint64_t nesting = state->nesting + depth;
+    writer_pad ( out, ' ', (nesting > 1) ? nesting : 1 );
+    if ( n == FLAT_NONE )
+    {
+        writer_string ( out, "(nil)\n" );
+        return WALK_CONTINUE;
+    }
+    flat_node_t *node = &tree->nodes[n];
+    writer_string ( out, node_string[node->type] );
+    if ( node->type == IDENTIFIER_DATA )
+    {
+        writer_char ( out, '(' );
+        writer_string ( out, node->data.ident->text );
+        writer_char ( out, ')' );
+    }
+    else if ( node->type == STRING_DATA && !(node->flags & FLAT_STRING_INDEX) )
+    {
+        writer_char ( out, '(' );
+        writer_string ( out, node->data.text );
+        writer_char ( out, ')' );
+    }
+    else if ( node->type == RELATION || node->type == EXPRESSION )
+    {
+        writer_char ( out, '(' );
+        writer_string ( out, operator_string[node->op] );
+        writer_char ( out, ')' );
+    }
+    else if ( node->type == NUMBER_DATA )
+    {
+        writer_char ( out, '(' );
+        writer_int ( out, node->data.number );
+        writer_char ( out, ')' );
+    }
+    writer_char ( out, '\n' );
+    return WALK_CONTINUE;
+}
+
+
+/* Same output as node_print */
+void
+flat_print ( writer_t *out, flat_tree_t *tree, flat_index_t root, int nesting )
+{
+    print_state_t state = { .out = out, .nesting = nesting };
+    flat_walk ( tree, root, print_flat_node, NULL, &state );
+}
+
+
+void
+flat_finalize ( flat_tree_t *tree )
+{
+    free ( tree->nodes );
+    free ( tree->edges );
+    free ( tree->entries );
+    *tree = (flat_tree_t) { .nodes = NULL };
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static int
+convert_node ( node_t **slot, uint64_t depth, void *context )
+{
+    convert_t *state = context;
+    flat_tree_t *tree = state->tree;
+    node_t *node = *slot;
+
+    flat_index_t index = FLAT_NONE, parent = FLAT_NONE;
+    if ( node != NULL )
+    {
+        int status = reserve ( tree, 1, node->n_children );
+        if ( status != FLAT_SUCCESS )
+        {
+            state->status = status;
+            return WALK_ABORT;
+        }
+        index = tree->n_nodes;
+    }
+
+    /* Fill in the parent's next child slot */
+    if ( depth > 0 )
+    {
+        parent = state->open[depth-1];
+        tree->edges[state->cursor[depth-1]++] = index;
+    }
+    if ( node == NULL )
+        return WALK_CONTINUE;
+
+    flat_node_t *flat = &tree->nodes[index];
+    *flat = (flat_node_t) {
+        .type = node->type,
+        .op = node->op,
+        .flags = 0,
+        .n_children = node->n_children,
+        .edges = tree->n_edges,
+        .parent = parent
+    };
+    switch ( node->type )
+    {
+        case NUMBER_DATA:
+            flat->data.number = *((int64_t *)node->data);
+            break;
+        case IDENTIFIER_DATA:
+            flat->data.ident = node->data;
+            break;
+        case STRING_DATA:
+            if ( state->strings_indexed )
+            {
+                flat->flags |= FLAT_STRING_INDEX;
+                flat->data.string = *((size_t *)node->data);
+            }
+            else
+                flat->data.text = node->data;
+            break;
+        default:
+            break;
+    }
+    tree->n_nodes += 1;
+    tree->n_edges += node->n_children;
+
+    if ( node->entry != NULL )
+    {
+        if ( tree->entries == NULL )
+        {
+            tree->entries = calloc ( tree->max_nodes, sizeof(symbol_t *) );
+            if ( tree->entries == NULL )
+            {
+                state->status = FLAT_ENOMEM;
+                return WALK_ABORT;
+            }
+        }
+        tree->entries[index] = node->entry;
+    }
+
+    /* Children are visited next, with this node open at this depth */
+    if ( depth == state->max_depth )
+    {
+        flat_index_t *open = realloc (
+            state->open, 2 * state->max_depth * sizeof(flat_index_t)
+        );
+        if ( open != NULL )
+            state->open = open;
+        uint32_t *cursor = realloc (
+            state->cursor, 2 * state->max_depth * sizeof(uint32_t)
+        );
+        if ( cursor != NULL )
+            state->cursor = cursor;
+        if ( open == NULL || cursor == NULL )
+        {
+            state->status = FLAT_ENOMEM;
+            return WALK_ABORT;
+        }
+        state->max_depth *= 2;
+    }
+    state->open[depth] = index;
+    state->cursor[depth] = flat->edges;
+    return WALK_CONTINUE;
+}
+
+
+/* Make room for n_nodes more nodes and n_edges more edges */
+static int
+reserve ( flat_tree_t *tree, uint32_t n_nodes, uint32_t n_edges )
+{
+    if ( (uint64_t)tree->n_nodes + n_nodes >= FLAT_NONE ||
+         (uint64_t)tree->n_edges + n_edges >= FLAT_NONE )
+        return FLAT_ETOOBIG;
+
+    if ( tree->n_nodes + n_nodes > tree->max_nodes )
+    {
+        uint32_t max_nodes = tree->max_nodes;
+        while ( tree->n_nodes + n_nodes > max_nodes )
+            max_nodes = (max_nodes < FLAT_NONE/2) ? 2*max_nodes : FLAT_NONE-1;
+        flat_node_t *nodes = realloc ( tree->nodes, max_nodes * sizeof(flat_node_t) );
+        if ( nodes == NULL )
+            return FLAT_ENOMEM;
+        tree->nodes = nodes;
+        if ( tree->entries != NULL )
+        {
+            symbol_t **entries = realloc (
+                tree->entries, max_nodes * sizeof(symbol_t *)
+            );
+            if ( entries == NULL )
+                return FLAT_ENOMEM;
+            memset (
+                entries + tree->max_nodes, 0,
+                (max_nodes - tree->max_nodes) * sizeof(symbol_t *)
+            );
+            tree->entries = entries;
+        }
+        tree->max_nodes = max_nodes;
+    }
+
+    if ( tree->n_edges + n_edges > tree->max_edges )
+    {
+        uint32_t max_edges = tree->max_edges;
+        while ( tree->n_edges + n_edges > max_edges )
+            max_edges = (max_edges < FLAT_NONE/2) ? 2*max_edges : FLAT_NONE-1;
+        flat_index_t *edges = realloc ( tree->edges, max_edges * sizeof(flat_index_t) );
+        if ( edges == NULL )
+            return FLAT_ENOMEM;
+        tree->edges = edges;
+        tree->max_edges = max_edges;
+    }
+    return FLAT_SUCCESS;
+}
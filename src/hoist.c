@@ -0,0 +1,238 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Loop-invariant expressions are hoisted out of while loops. An
+ * expression is invariant in a loop when it calls nothing, and none of
+ * its variables is assigned in the loop or declared in it. If the loop
+ * calls a function, globals count as assigned. Divisions are only
+ * hoisted when the divisor is a constant that cannot trap, since the
+ * loop may not run at all. Each largest invariant expression is
+ * assigned to a fresh local before the loop, and the loop uses that
+ * local instead. The locals are declared in a block that wraps the
+ * loop, so they are visible exactly where they are used. Inner loops
+ * are done first, so that what they hoist may move further out.
+ */
+
+typedef struct {
+    vslc_context_t *ctx;
+    symbol_t *function;
+    uint64_t scope;             /* Largest scope value the function uses */
+    size_t seq;                 /* Number of the next local variable */
+    size_t n_hoisted;           /* Names the locals */
+    /* Of the loop at hand */
+    tlhash_t *assigned;         /* Symbols assigned in the loop */
+    tlhash_t *declared;         /* Identifiers declaring its locals */
+    tlhash_t *invariant;        /* Invariant nodes */
+    bool calls;
+    node_t ***hoisted;          /* Slots of the expressions to hoist */
+    size_t n_slots, max_slots;
+} hoister_t;
+
+static int hoist_loop ( node_t **slot, uint64_t depth, void *context );
+static int survey ( node_t **slot, uint64_t depth, void *context );
+static int mark_invariant ( node_t **slot, uint64_t depth, void *context );
+static bool is_invariant ( hoister_t *hoister, node_t *node );
+static node_t *wrap ( hoister_t *hoister, node_t *loop );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+hoist_invariants ( vslc_context_t *ctx, symbol_t *function )
+{
+    hoister_t hoister = { .ctx = ctx, .function = function, .n_hoisted = 0, .hoisted = NULL };
+    if ( !local_extent ( function, &hoister.scope, &hoister.seq ) )
+        return;
+    tree_walk ( &function->node->children[2], skip_expressions, hoist_loop, &hoister );
+    free ( hoister.hoisted );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static int
+hoist_loop ( node_t **slot, uint64_t depth, void *context )
+{
+    hoister_t *hoister = context;
+    if ( (*slot)->type != WHILE_STATEMENT )
+        return WALK_CONTINUE;
+
+    tlhash_t assigned, declared, invariant;
+    if ( tlhash_init ( &assigned, 16 ) != TLHASH_SUCCESS )
+        return WALK_CONTINUE;
+    if ( tlhash_init ( &declared, 16 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &assigned );
+        return WALK_CONTINUE;
+    }
+    if ( tlhash_init ( &invariant, 64 ) != TLHASH_SUCCESS )
+    {
+        tlhash_finalize ( &assigned );
+        tlhash_finalize ( &declared );
+        return WALK_CONTINUE;
+    }
+    hoister->assigned = &assigned;
+    hoister->declared = &declared;
+    hoister->invariant = &invariant;
+    hoister->calls = false;
+    hoister->n_slots = 0;
+
+    if ( tree_walk ( slot, survey, NULL, hoister ) == 0 &&
+         tree_walk ( slot, NULL, mark_invariant, hoister ) == 0 &&
+         hoister->n_slots > 0 )
+        *slot = wrap ( hoister, *slot );
+
+    tlhash_finalize ( &assigned );
+    tlhash_finalize ( &declared );
+    tlhash_finalize ( &invariant );
+    return WALK_CONTINUE;
+}
+
+
+/* What the loop assigns, declares and calls */
+static int
+survey ( node_t **slot, uint64_t depth, void *context )
+{
+    hoister_t *hoister = context;
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    switch ( node->type )
+    {
+        case ASSIGNMENT_STATEMENT:
+            if ( node->children[0]->entry != NULL &&
+                 add_to_set ( hoister->assigned, node->children[0]->entry ) == TLHASH_ENOMEM )
+                return WALK_ABORT;
+            break;
+        case DECLARATION:
+        {
+            node_t *names = node->children[0];
+            for ( uint64_t n=0; n<names->n_children; n++ )
+                if ( add_to_set ( hoister->declared, names->children[n] ) == TLHASH_ENOMEM )
+                    return WALK_ABORT;
+            return WALK_SKIP_CHILDREN;
+        }
+        case EXPRESSION:
+            if ( node->op == OP_NONE && node->n_children == 2 )
+                hoister->calls = true;
+            break;
+        default:
+            break;
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* Marks invariant nodes on the way up. The invariant operands of a node
+ * that is not invariant itself are the largest invariant expressions,
+ * and are hoisted if they have an operator to save.
+ */
+static int
+mark_invariant ( node_t **slot, uint64_t depth, void *context )
+{
+    hoister_t *hoister = context;
+    node_t *node = *slot;
+    if ( is_invariant ( hoister, node ) )
+        return ( add_to_set ( hoister->invariant, node ) == TLHASH_ENOMEM ) ? WALK_ABORT : WALK_CONTINUE;
+
+    for ( uint64_t c=0; c<node->n_children; c++ )
+    {
+        node_t *child = node->children[c];
+        if ( child == NULL || child->type != EXPRESSION || !in_set ( hoister->invariant, child ) )
+            continue;
+        if ( hoister->n_slots == hoister->max_slots )
+        {
+            size_t max_slots = ( hoister->max_slots > 0 ) ? 2 * hoister->max_slots : 8;
+            node_t ***grown = realloc ( hoister->hoisted, max_slots * sizeof(node_t **) );
+            if ( grown == NULL )
+                return WALK_ABORT;
+            hoister->hoisted = grown;
+            hoister->max_slots = max_slots;
+        }
+        hoister->hoisted[hoister->n_slots++] = &node->children[c];
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* Whether the node's value is the same whenever the loop evaluates it,
+ * given that its children have been marked
+ */
+static bool
+is_invariant ( hoister_t *hoister, node_t *node )
+{
+    switch ( node->type )
+    {
+        case NUMBER_DATA:
+            return true;
+        case IDENTIFIER_DATA:
+        {
+            symbol_t *symbol = node->entry;
+            if ( symbol == NULL || symbol->type == SYM_FUNCTION ||
+                 (symbol->type == SYM_GLOBAL_VAR && hoister->calls) )
+                return false;
+            return !in_set ( hoister->assigned, symbol ) && !in_set ( hoister->declared, symbol->node );
+        }
+        case EXPRESSION:
+            if ( node->op == OP_NONE )
+                return false;
+            if ( node->op == OP_DIV )
+            {
+                /* Neither a division by zero nor INT64_MIN / -1 */
+                node_t *divisor = node->children[1];
+                if ( divisor->type != NUMBER_DATA || *((int64_t *) divisor->data) == 0 ||
+                     *((int64_t *) divisor->data) == -1 )
+                    return false;
+            }
+            for ( uint64_t c=0; c<node->n_children; c++ )
+                if ( !in_set ( hoister->invariant, node->children[c] ) )
+                    return false;
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/* begin var invariant.n, ... invariant.n := expression ... loop end */
+static node_t *
+wrap ( hoister_t *hoister, node_t *loop )
+{
+    arena_t *arena = &hoister->ctx->tree_arena;
+    size_t n_slots = hoister->n_slots;
+    node_t *names = make_list ( arena, VARIABLE_LIST, n_slots );
+    node_t *statements = make_list ( arena, STATEMENT_LIST, n_slots + 1 );
+    hoister->scope += 1;
+    for ( size_t s=0; s<n_slots; s++ )
+    {
+        char name[32];
+        snprintf ( name, sizeof(name), "invariant.%zu", hoister->n_hoisted );
+        symbol_t *local = add_local (
+            hoister->ctx, hoister->function, name, hoister->scope, hoister->seq
+        );
+        if ( local == NULL )
+            break;
+        hoister->n_hoisted += 1;
+        hoister->seq += 1;
+
+        node_t **slot = hoister->hoisted[s];
+        node_t *assignment = arena_alloc ( arena, sizeof(node_t) );
+        node_init (
+            assignment, arena, ASSIGNMENT_STATEMENT, NULL, 2, make_reference ( arena, local ), *slot
+        );
+        *slot = make_reference ( arena, local );
+        names->children[names->n_children++] = local->node;
+        statements->children[statements->n_children++] = assignment;
+    }
+    if ( names->n_children == 0 )
+        return loop;
+    statements->children[statements->n_children++] = loop;
+
+    return make_declaring_block ( arena, names, statements );
+}
@@ -0,0 +1,587 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vslc.h>
+#include <image.h>
+#include <optimize.h>
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+/* What image_save gathers before it writes anything */
+typedef struct {
+    flat_tree_t flat;
+    symbol_t **symbols;
+    image_symbol_t *records;
+    size_t n_symbols, max_symbols;
+    ident_t **names;
+    size_t n_names, max_names;
+    tlhash_t symbol_index, name_index, node_index;
+} save_t;
+
+static int collect_symbols ( vslc_context_t *ctx, save_t *save );
+static uint32_t add_symbol ( save_t *save, symbol_t *symbol, uint64_t scope );
+static uint32_t name_index ( save_t *save, ident_t *name );
+static int find_declarations ( node_t **slot, uint64_t depth, void *context );
+static const char *text_at ( image_t *image, uint64_t offset );
+static int check_section (
+    image_t *image, image_section_t *section, size_t record_size, size_t alignment
+);
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Writes the compiled program in ctx to fd. The symbol table must be
+ * built, so that strings are indexed and names are bound.
+ * Returns
+ *  SUCCESS - the image is written
+ *  ENOMEM - no memory available
+ *  EIO - writing failed
+ *  EFORMAT - the program is too big for the format
+ */
+int
+image_save ( vslc_context_t *ctx, int fd )
+{
+    save_t save = { .n_symbols = 0, .n_names = 0 };
+    int status = IMAGE_SUCCESS;
+    tlhash_init ( &save.symbol_index, 64 );
+    tlhash_init ( &save.name_index, 64 );
+    tlhash_init ( &save.node_index, 64 );
+
+    if ( flat_init ( &save.flat, 0 ) != FLAT_SUCCESS )
+        status = IMAGE_ENOMEM;
+    else if ( (status = flat_from_tree ( &save.flat, ctx->root, true )) != FLAT_SUCCESS )
+        status = ( status == FLAT_ENOMEM ) ? IMAGE_ENOMEM : IMAGE_EFORMAT;
+    else
+        status = collect_symbols ( ctx, &save );
+    if ( status != IMAGE_SUCCESS )
+        goto done;
+
+    /* Declaring nodes, by their pre-order position */
+    uint32_t position = 0;
+    void *walk_context[2] = { &save, &position };
+    tree_walk ( &ctx->root, find_declarations, NULL, walk_context );
+
+    /* Identifier nodes may name what no symbol is declared as */
+    flat_tree_t *flat = &save.flat;
+    for ( flat_index_t n=0; n<flat->n_nodes; n++ )
+        if ( flat->nodes[n].type == IDENTIFIER_DATA &&
+             name_index ( &save, flat->nodes[n].data.ident ) == IMAGE_NONE )
+        {
+            status = IMAGE_ENOMEM;
+            goto done;
+        }
+
+    /* Lay out the sections */
+    image_header_t header = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .byte_order = IMAGE_BYTE_ORDER,
+        .n_globals = tlhash_size ( ctx->global_names )
+    };
+    uint64_t offset = ALIGN8 ( sizeof(image_header_t) );
+    header.nodes = (image_section_t) { offset, flat->n_nodes };
+    offset += flat->n_nodes * sizeof(image_node_t);
+    header.edges = (image_section_t) { offset, flat->n_edges };
+    offset = ALIGN8 ( offset + flat->n_edges * sizeof(uint32_t) );
+    header.symbols = (image_section_t) { offset, save.n_symbols };
+    offset += save.n_symbols * sizeof(image_symbol_t);
+    header.names = (image_section_t) { offset, save.n_names };
+    offset += save.n_names * sizeof(uint64_t);
+    header.strings = (image_section_t) { offset, ctx->stringc };
+    offset += ctx->stringc * sizeof(uint64_t);
+    uint64_t texts = offset;
+    for ( size_t i=0; i<save.n_names; i++ )
+        offset += save.names[i]->length + 1;
+    for ( size_t i=0; i<ctx->stringc; i++ )
+        offset += strlen ( ctx->string_list[i] ) + 1;
+    header.size = offset;
+
+    writer_t out;
+    if ( writer_init ( &out, fd, WRITER_BUFFER_SIZE ) != WRITER_SUCCESS )
+    {
+        status = IMAGE_ENOMEM;
+        goto done;
+    }
+    const uint64_t zero = 0;
+    writer_bytes ( &out, (const char *)&header, sizeof(header) );
+    writer_bytes ( &out, (const char *)&zero, header.nodes.offset - sizeof(header) );
+
+    for ( flat_index_t n=0; n<flat->n_nodes; n++ )
+    {
+        flat_node_t *node = &flat->nodes[n];
+        symbol_t *entry = ( flat->entries != NULL ) ? flat->entries[n] : NULL;
+        uint32_t symbol = ( entry != NULL ) ?
+            lookup_index ( &save.symbol_index, entry ) : NO_INDEX;
+        image_node_t record = {
+            .type = node->type,
+            .op = node->op,
+            .flags = node->flags,
+            .n_children = node->n_children,
+            .edges = node->edges,
+            .symbol = ( symbol != NO_INDEX ) ? symbol : IMAGE_NONE,
+            .data = 0
+        };
+        if ( node->type == NUMBER_DATA )
+            record.data = node->data.number;
+        else if ( node->type == STRING_DATA )
+            record.data = node->data.string;
+        else if ( node->type == IDENTIFIER_DATA )
+            record.data = name_index ( &save, node->data.ident );
+        writer_bytes ( &out, (const char *)&record, sizeof(record) );
+    }
+    writer_bytes (
+        &out, (const char *)flat->edges, flat->n_edges * sizeof(uint32_t)
+    );
+    writer_bytes (
+        &out, (const char *)&zero,
+        header.symbols.offset - header.edges.offset - flat->n_edges * sizeof(uint32_t)
+    );
+    writer_bytes (
+        &out, (const char *)save.records, save.n_symbols * sizeof(image_symbol_t)
+    );
+
+    uint64_t text = texts;
+    for ( size_t i=0; i<save.n_names; i++ )
+    {
+        writer_bytes ( &out, (const char *)&text, sizeof(text) );
+        text += save.names[i]->length + 1;
+    }
+    for ( size_t i=0; i<ctx->stringc; i++ )
+    {
+        writer_bytes ( &out, (const char *)&text, sizeof(text) );
+        text += strlen ( ctx->string_list[i] ) + 1;
+    }
+    for ( size_t i=0; i<save.n_names; i++ )
+        writer_bytes ( &out, save.names[i]->text, save.names[i]->length + 1 );
+    for ( size_t i=0; i<ctx->stringc; i++ )
+        writer_bytes (
+            &out, ctx->string_list[i], strlen ( ctx->string_list[i] ) + 1
+        );
+    if ( writer_finalize ( &out ) != WRITER_SUCCESS )
+        status = IMAGE_EIO;
+
+done:
+    flat_finalize ( &save.flat );
+    free ( save.symbols );
+    free ( save.records );
+    free ( save.names );
+    tlhash_finalize ( &save.symbol_index );
+    tlhash_finalize ( &save.name_index );
+    tlhash_finalize ( &save.node_index );
+    return status;
+}
+
+
+/* Maps the image in fd, and checks that everything in it is in bounds
+ * Returns
+ *  SUCCESS - image can be loaded
+ *  EIO - fd could not be mapped
+ *  EFORMAT - fd does not hold an image of this version and byte order
+ */
+int
+image_map ( image_t *image, int fd )
+{
+    struct stat st;
+    *image = (image_t) { .base = NULL, .size = 0, .header = NULL };
+    if ( fstat ( fd, &st ) != 0 || ! S_ISREG ( st.st_mode ) )
+        return IMAGE_EIO;
+    if ( (size_t) st.st_size < sizeof(image_header_t) )
+        return IMAGE_EFORMAT;
+
+    void *base = mmap ( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( base == MAP_FAILED )
+        return IMAGE_EIO;
+    *image = (image_t) {
+        .base = base, .size = st.st_size, .header = base
+    };
+
+    image_header_t header = *image->header;
+    if ( memcmp ( header.magic, IMAGE_MAGIC, 4 ) != 0 ||
+         header.version != IMAGE_VERSION ||
+         header.byte_order != IMAGE_BYTE_ORDER ||
+         header.size != image->size ||
+         header.n_globals > header.symbols.count ||
+         check_section ( image, &header.nodes, sizeof(image_node_t), 8 ) ||
+         check_section ( image, &header.edges, sizeof(uint32_t), 4 ) ||
+         check_section ( image, &header.symbols, sizeof(image_symbol_t), 8 ) ||
+         check_section ( image, &header.names, sizeof(uint64_t), 8 ) ||
+         check_section ( image, &header.strings, sizeof(uint64_t), 8 ) )
+    {
+        image_unmap ( image );
+        return IMAGE_EFORMAT;
+    }
+    return IMAGE_SUCCESS;
+}
+
+
+/* Rebuilds the symbol tables and string table of ctx, which must be
+ * fresh, and the flat tree, from a mapped image. String texts are
+ * used in place, so the image has to stay mapped while ctx is in use.
+ * Symbols have no node_t to point to. The tree is initialized either
+ * way, and has to be finalized by the caller.
+ * Returns
+ *  SUCCESS - ctx and tree are as right after compiling the program
+ *  ENOMEM - no memory available
+ *  EFORMAT - an index in the image is out of range
+ */
+int
+image_load ( vslc_context_t *ctx, image_t *image, flat_tree_t *tree )
+{
+    const image_header_t *header = image->header;
+    const image_node_t *nodes = (const void *)(image->base + header->nodes.offset);
+    const uint32_t *edges = (const void *)(image->base + header->edges.offset);
+    const image_symbol_t *records = (const void *)(image->base + header->symbols.offset);
+    const uint64_t *names = (const void *)(image->base + header->names.offset);
+    const uint64_t *strings = (const void *)(image->base + header->strings.offset);
+    size_t n_nodes = header->nodes.count, n_edges = header->edges.count;
+    size_t n_symbols = header->symbols.count, n_names = header->names.count;
+    size_t n_globals = header->n_globals;
+
+    if ( flat_init ( tree, 0 ) != FLAT_SUCCESS )
+        return IMAGE_ENOMEM;
+    if ( n_nodes >= FLAT_NONE || n_edges >= FLAT_NONE || n_symbols >= IMAGE_NONE )
+        return IMAGE_EFORMAT;
+
+    int status = IMAGE_ENOMEM;
+    ident_t **ids = malloc ( (n_names + 1) * sizeof(ident_t *) );
+    symbol_t **symbols = calloc ( n_symbols + 1, sizeof(symbol_t *) );
+    symbol_t **bound = malloc ( (n_symbols + 1) * sizeof(symbol_t *) );
+    if ( ids == NULL || symbols == NULL || bound == NULL )
+        goto done;
+
+    /* Names are interned anew, their hashes depend on this run's backend */
+    status = IMAGE_EFORMAT;
+    for ( size_t i=0; i<n_names; i++ )
+    {
+        const char *text = text_at ( image, names[i] );
+        if ( text == NULL )
+            goto done;
+        if ( (ids[i] = intern ( &ctx->identifiers, text )) == NULL )
+            goto enomem;
+    }
+
+    char **string_list = realloc (
+        ctx->string_list, (header->strings.count + 1) * sizeof(char *)
+    );
+    if ( string_list == NULL )
+        goto enomem;
+    ctx->string_list = string_list;
+    ctx->n_string_list = header->strings.count + 1;
+    for ( ctx->stringc=0; ctx->stringc<header->strings.count; ctx->stringc++ )
+    {
+        const char *text = text_at ( image, strings[ctx->stringc] );
+        if ( text == NULL )
+            goto done;
+        ctx->string_list[ctx->stringc] = (char *) text;
+    }
+
+    for ( size_t s=0; s<n_symbols; s++ )
+    {
+        const image_symbol_t *record = &records[s];
+        if ( record->name >= n_names || record->type > SYM_LOCAL_VAR ||
+             ( record->n_locals > 0 &&
+               ( record->type != SYM_FUNCTION || s >= n_globals ||
+                 record->locals < n_globals ||
+                 record->locals > n_symbols - record->n_locals ) ) )
+            goto done;
+        if ( (symbols[s] = malloc ( sizeof(symbol_t) )) == NULL )
+            goto enomem;
+        *symbols[s] = (symbol_t) {
+            .name = ids[record->name],
+            .type = record->type,
+            .node = NULL,
+            .seq = record->seq,
+            .nparms = record->nparms,
+            .locals = NULL,
+            .shadowed = NULL
+        };
+        bound[s] = symbols[s];
+    }
+
+    /* Tables, filled in the order the symbols first went in. A symbol
+     * leaves symbols[] once a table owns it.
+     */
+    if ( (ctx->global_names = malloc ( sizeof(tlhash_t) )) == NULL )
+        goto enomem;
+    tlhash_init ( ctx->global_names, 32 );
+    for ( size_t g=0; g<n_globals; g++ )
+    {
+        symbol_key_t key;
+        symbol_t *global = symbols[g];
+        uint32_t hash = make_symbol_key ( &key, GLOBAL_SCOPE, global->name );
+        if ( tlhash_insert_hashed (
+                ctx->global_names, &key, sizeof(key), hash, global
+             ) != TLHASH_SUCCESS )
+            goto done;
+        symbols[g] = NULL;
+        if ( global->type != SYM_FUNCTION )
+            continue;
+
+        if ( (global->locals = malloc ( sizeof(tlhash_t) )) == NULL )
+            goto enomem;
+        tlhash_init ( global->locals, 64 );
+        ctx->func_count += 1;
+        size_t first = records[g].locals, last = first + records[g].n_locals;
+        for ( size_t l=first; l<last; l++ )
+        {
+            if ( symbols[l] == NULL )
+                goto done;
+            hash = make_symbol_key ( &key, records[l].scope, symbols[l]->name );
+            if ( tlhash_insert_hashed (
+                    global->locals, &key, sizeof(key), hash, symbols[l]
+                 ) != TLHASH_SUCCESS )
+                goto done;
+            symbols[l] = NULL;
+        }
+    }
+    for ( size_t s=0; s<n_symbols; s++ )
+        if ( symbols[s] != NULL )
+            goto done;
+
+    /* The tree */
+    flat_node_t *flat_nodes = realloc ( tree->nodes, (n_nodes + 1) * sizeof(flat_node_t) );
+    if ( flat_nodes != NULL )
+        tree->nodes = flat_nodes;
+    flat_index_t *flat_edges = realloc ( tree->edges, (n_edges + 1) * sizeof(flat_index_t) );
+    if ( flat_edges != NULL )
+        tree->edges = flat_edges;
+    tree->entries = calloc ( n_nodes + 1, sizeof(symbol_t *) );
+    if ( flat_nodes == NULL || flat_edges == NULL || tree->entries == NULL )
+        goto enomem;
+    tree->max_nodes = n_nodes + 1;
+    tree->max_edges = n_edges + 1;
+    memcpy ( tree->edges, edges, n_edges * sizeof(uint32_t) );
+
+    for ( size_t n=0; n<n_nodes; n++ )
+    {
+        const image_node_t *record = &nodes[n];
+        if ( record->type > STRING_DATA || record->op > OP_GT ||
+             record->n_children > n_edges ||
+             record->edges > n_edges - record->n_children ||
+             ( record->symbol != IMAGE_NONE && record->symbol >= n_symbols ) ||
+             ( record->type == IDENTIFIER_DATA &&
+               ( record->data < 0 || (uint64_t) record->data >= n_names ) ) ||
+             ( record->type == STRING_DATA &&
+               ( !(record->flags & FLAT_STRING_INDEX) || record->data < 0 ||
+                 (uint64_t) record->data >= ctx->stringc ) ) )
+            goto done;
+        flat_node_t *node = &tree->nodes[n];
+        *node = (flat_node_t) {
+            .type = record->type,
+            .op = record->op,
+            .flags = record->flags,
+            .n_children = record->n_children,
+            .edges = record->edges,
+            .parent = FLAT_NONE
+        };
+        if ( record->type == IDENTIFIER_DATA )
+            node->data.ident = ids[record->data];
+        else if ( record->type == STRING_DATA )
+            node->data.string = record->data;
+        else
+            node->data.number = record->data;
+        if ( record->symbol != IMAGE_NONE )
+            tree->entries[n] = bound[record->symbol];
+        tree->n_nodes += 1;
+    }
+    tree->n_edges = n_edges;
+
+    /* Children come after their parents in pre-order */
+    for ( flat_index_t n=0; n<n_nodes; n++ )
+        for ( uint32_t c=0; c<tree->nodes[n].n_children; c++ )
+        {
+            flat_index_t child = FLAT_CHILD ( tree, n, c );
+            if ( child == FLAT_NONE )
+                continue;
+            if ( child <= n || child >= n_nodes ||
+                 tree->nodes[child].parent != FLAT_NONE )
+                goto done;
+            tree->nodes[child].parent = n;
+        }
+    status = IMAGE_SUCCESS;
+    goto done;
+
+enomem:
+    status = IMAGE_ENOMEM;
+done:
+    for ( size_t s=0; symbols != NULL && s<n_symbols; s++ )
+        free ( symbols[s] );
+    free ( ids );
+    free ( symbols );
+    free ( bound );
+    return status;
+}
+
+
+void
+image_unmap ( image_t *image )
+{
+    if ( image->base != NULL )
+        munmap ( (void *) image->base, image->size );
+    *image = (image_t) { .base = NULL, .size = 0, .header = NULL };
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Symbols in image order: globals as the table holds them, then each
+ * function's locals
+ */
+static int
+collect_symbols ( vslc_context_t *ctx, save_t *save )
+{
+    size_t n_globals = tlhash_size ( ctx->global_names );
+    symbol_t **globals = malloc ( (n_globals + 1) * sizeof(symbol_t *) );
+    if ( globals == NULL )
+        return IMAGE_ENOMEM;
+    tlhash_values ( ctx->global_names, (void **)globals );
+    for ( size_t g=0; g<n_globals; g++ )
+        if ( add_symbol ( save, globals[g], GLOBAL_SCOPE ) == IMAGE_NONE )
+            goto enomem;
+
+    for ( size_t g=0; g<n_globals; g++ )
+    {
+        if ( globals[g]->locals == NULL )
+            continue;
+        size_t n_locals = tlhash_size ( globals[g]->locals );
+        symbol_t **locals = malloc ( (n_locals + 1) * sizeof(symbol_t *) );
+        symbol_key_t **keys = malloc ( (n_locals + 1) * sizeof(symbol_key_t *) );
+        if ( locals == NULL || keys == NULL )
+        {
+            free ( locals );
+            free ( keys );
+            goto enomem;
+        }
+        tlhash_values ( globals[g]->locals, (void **)locals );
+        tlhash_keys ( globals[g]->locals, (void **)keys );
+        save->records[g].locals = save->n_symbols;
+        save->records[g].n_locals = n_locals;
+        int failed = 0;
+        for ( size_t l=0; l<n_locals && !failed; l++ )
+            failed = ( add_symbol ( save, locals[l], keys[l]->scope ) == IMAGE_NONE );
+        free ( locals );
+        free ( keys );
+        if ( failed )
+            goto enomem;
+    }
+    free ( globals );
+    return IMAGE_SUCCESS;
+
+enomem:
+    free ( globals );
+    return IMAGE_ENOMEM;
+}
+
+
+static uint32_t
+add_symbol ( save_t *save, symbol_t *symbol, uint64_t scope )
+{
+    if ( save->n_symbols == save->max_symbols )
+    {
+        size_t max = ( save->max_symbols > 0 ) ? 2 * save->max_symbols : 64;
+        symbol_t **symbols = realloc ( save->symbols, max * sizeof(symbol_t *) );
+        if ( symbols != NULL )
+            save->symbols = symbols;
+        image_symbol_t *records = realloc ( save->records, max * sizeof(image_symbol_t) );
+        if ( records != NULL )
+            save->records = records;
+        if ( symbols == NULL || records == NULL )
+            return IMAGE_NONE;
+        save->max_symbols = max;
+    }
+    uint32_t index = save->n_symbols;
+    uint32_t name = name_index ( save, symbol->name );
+    if ( name == IMAGE_NONE ||
+         store_index ( &save->symbol_index, symbol, index ) != TLHASH_SUCCESS ||
+         ( symbol->node != NULL &&
+           store_index ( &save->node_index, symbol->node, index ) != TLHASH_SUCCESS ) )
+        return IMAGE_NONE;
+    save->symbols[index] = symbol;
+    save->records[index] = (image_symbol_t) {
+        .name = name,
+        .type = symbol->type,
+        .scope = scope,
+        .seq = symbol->seq,
+        .nparms = symbol->nparms,
+        .node = IMAGE_NONE,
+        .n_locals = 0,
+        .locals = 0
+    };
+    save->n_symbols += 1;
+    return index;
+}
+
+
+static uint32_t
+name_index ( save_t *save, ident_t *name )
+{
+    uint32_t index = lookup_index ( &save->name_index, name );
+    if ( index != NO_INDEX )
+        return index;
+    if ( save->n_names == save->max_names )
+    {
+        size_t max = ( save->max_names > 0 ) ? 2 * save->max_names : 64;
+        ident_t **names = realloc ( save->names, max * sizeof(ident_t *) );
+        if ( names == NULL )
+            return IMAGE_NONE;
+        save->names = names;
+        save->max_names = max;
+    }
+    index = save->n_names;
+    if ( store_index ( &save->name_index, name, index ) != TLHASH_SUCCESS )
+        return IMAGE_NONE;
+    save->names[save->n_names++] = name;
+    return index;
+}
+
+
+/* Numbers nodes in pre-order, as flat_from_tree does, and notes the
+ * number of each symbol's declaring node
+ */
+static int
+find_declarations ( node_t **slot, uint64_t depth, void *context )
+{
+    void **walk_context = context;
+    save_t *save = walk_context[0];
+    uint32_t *position = walk_context[1];
+    if ( *slot == NULL )
+        return WALK_CONTINUE;
+    uint32_t symbol = lookup_index ( &save->node_index, *slot );
+    if ( symbol != NO_INDEX )
+        save->records[symbol].node = *position;
+    *position += 1;
+    return WALK_CONTINUE;
+}
+
+
+/* A NUL-terminated text inside the image, or NULL if it runs off the end */
+static const char *
+text_at ( image_t *image, uint64_t offset )
+{
+    if ( offset >= image->size )
+        return NULL;
+    const char *text = image->base + offset;
+    if ( memchr ( text, '\0', image->size - offset ) == NULL )
+        return NULL;
+    return text;
+}
+
+
+/* Whether the section does not fit in the image, or is not aligned for
+ * its records, which are read in place
+ */
+static int
+check_section (
+    image_t *image, image_section_t *section, size_t record_size, size_t alignment
+)
+{
+    return section->offset > image->size ||
+        section->count > (image->size - section->offset) / record_size ||
+        section->offset % alignment != 0;
+}
@@ -0,0 +1,437 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Inlining of small leaf functions. A function is a candidate when it
+ * calls nothing, has no strings, returns only at the end of its body,
+ * and is at most INLINE_MAX_SIZE nodes. A call of a candidate whose
+ * body is a single return becomes the returned expression, with the
+ * arguments in place of the parameters. Calls of other candidates are
+ * inlined where they are all of an assignment's value, or of a return.
+ * The statement becomes a block with the following: fresh locals of the
+ * caller that stand in for the parameters, assignments of the arguments
+ * to them, and a copy of the callee's body. The copy's own locals are
+ * fresh locals of the caller too, and its final return becomes the
+ * assignment or return. A caller grows by at most INLINE_BUDGET nodes,
+ * and its expressions are folded again once calls have been inlined.
+ */
+
+#define INLINE_MAX_SIZE 32
+#define INLINE_BUDGET 512
+
+typedef struct {
+    symbol_t *function;
+    node_t *body;
+    node_t *value;              /* Returned at the end of the body */
+    bool single;                /* The body is nothing but that return */
+    uint64_t size;              /* Nodes in the body */
+    size_t n_symbols;           /* Parameters and locals, */
+    symbol_t **symbols;         /*  and the scope values */
+    uint64_t *scopes;           /*  they are declared with */
+    uint64_t max_scope;
+} callee_t;
+
+typedef struct {
+    vslc_context_t *ctx;
+    arena_t *arena;
+    tlhash_t *callees;          /* Function symbols to their callee_t */
+    symbol_t *caller;
+    uint64_t scope;             /* Largest scope value the caller uses */
+    size_t seq;                 /* Number of the next local variable */
+    uint64_t budget;            /* Nodes the caller may still grow by */
+    bool changed;
+    /* While a callee is copied */
+    callee_t *callee;
+    node_t **arguments;         /* Put in place of the parameters, */
+    symbol_t **renamed;         /*  or else these fresh locals */
+} inliner_t;
+
+typedef struct {
+    size_t n_returns, n_calls, n_strings;
+} census_t;
+
+typedef struct {
+    symbol_t *symbol;
+    size_t n_uses;
+} uses_t;
+
+static bool examine ( callee_t *callee, symbol_t *function );
+static int count_node ( node_t **slot, uint64_t depth, void *context );
+static int count_uses ( node_t **slot, uint64_t depth, void *context );
+static int inline_site ( node_t **slot, uint64_t depth, void *context );
+static callee_t *candidate ( inliner_t *inliner, node_t *expression );
+static node_t *substitute ( inliner_t *inliner, callee_t *callee, node_t *call );
+static node_t *expand ( inliner_t *inliner, callee_t *callee, node_t *call, node_t *statement );
+static node_t *copy ( inliner_t *inliner, node_t *node );
+static symbol_t *parameter ( callee_t *callee, size_t p );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+inline_calls ( vslc_context_t *ctx, symbol_t **functions, size_t n_functions )
+{
+    tlhash_t callees;
+    callee_t *info = calloc ( n_functions + 1, sizeof(callee_t) );
+    if ( info == NULL )
+        return;
+    if ( tlhash_init ( &callees, 16 ) != TLHASH_SUCCESS )
+    {
+        free ( info );
+        return;
+    }
+
+    /* Candidates are chosen before anything is inlined, so that the
+     * outcome does not depend on the order functions are visited in
+     */
+    for ( size_t f=0; f<n_functions; f++ )
+    {
+        symbol_t *function = functions[f];
+        if ( function->type == SYM_FUNCTION && examine ( &info[f], function ) )
+            tlhash_insert ( &callees, &function, sizeof(function), &info[f] );
+    }
+
+    for ( size_t f=0; f<n_functions && tlhash_size ( &callees ) > 0; f++ )
+    {
+        if ( functions[f]->type != SYM_FUNCTION )
+            continue;
+        inliner_t inliner = {
+            .ctx = ctx,
+            .arena = &ctx->tree_arena,
+            .callees = &callees,
+            .caller = functions[f],
+            .budget = INLINE_BUDGET,
+            .changed = false
+        };
+        if ( !local_extent ( functions[f], &inliner.scope, &inliner.seq ) )
+            break;
+        node_t **body = &functions[f]->node->children[2];
+        tree_walk ( body, NULL, inline_site, &inliner );
+        if ( inliner.changed )
+            fold_tree ( body );
+    }
+
+    for ( size_t f=0; f<n_functions; f++ )
+    {
+        free ( info[f].symbols );
+        free ( info[f].scopes );
+    }
+    free ( info );
+    tlhash_finalize ( &callees );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static bool
+examine ( callee_t *callee, symbol_t *function )
+{
+    node_t *body = function->node->children[2];
+    callee->function = function;
+    callee->body = body;
+    callee->size = stats_count_nodes ( body );
+    if ( callee->size > INLINE_MAX_SIZE )
+        return false;
+
+    census_t census = { .n_returns = 0 };
+    tree_walk ( &body, count_node, NULL, &census );
+    if ( census.n_returns != 1 || census.n_calls > 0 || census.n_strings > 0 )
+        return false;
+
+    /* The one return has to be the last statement of the body */
+    node_t *last = body;
+    if ( body->type == BLOCK )
+    {
+        node_t *statements = body->children[body->n_children - 1];
+        if ( statements->n_children == 0 )
+            return false;
+        last = statements->children[statements->n_children - 1];
+        callee->single = ( body->n_children == 1 && statements->n_children == 1 );
+    }
+    else
+        callee->single = true;
+    if ( last->type != RETURN_STATEMENT )
+        return false;
+    callee->value = last->children[0];
+
+    tlhash_t *locals = function->locals;
+    size_t n_symbols = tlhash_size ( locals );
+    symbol_key_t **keys = malloc ( (n_symbols + 1) * sizeof(symbol_key_t *) );
+    callee->symbols = malloc ( (n_symbols + 1) * sizeof(symbol_t *) );
+    callee->scopes = malloc ( (n_symbols + 1) * sizeof(uint64_t) );
+    if ( keys == NULL || callee->symbols == NULL || callee->scopes == NULL )
+    {
+        free ( keys );
+        return false;
+    }
+    tlhash_values ( locals, (void **)callee->symbols );
+    tlhash_keys ( locals, (void **)keys );
+    callee->n_symbols = n_symbols;
+    callee->max_scope = GLOBAL_SCOPE;
+    for ( size_t s=0; s<n_symbols; s++ )
+    {
+        callee->scopes[s] = keys[s]->scope;
+        if ( keys[s]->scope > callee->max_scope )
+            callee->max_scope = keys[s]->scope;
+    }
+    free ( keys );
+
+    /* A parameter that could not be declared has no symbol */
+    for ( size_t p=0; p<function->nparms; p++ )
+        if ( parameter ( callee, p ) == NULL )
+            return false;
+    return true;
+}
+
+
+static int
+count_node ( node_t **slot, uint64_t depth, void *context )
+{
+    census_t *census = context;
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    if ( node->type == RETURN_STATEMENT )
+        census->n_returns += 1;
+    else if ( node->type == STRING_DATA )
+        census->n_strings += 1;
+    else if ( node->type == EXPRESSION && node->op == OP_NONE && node->n_children == 2 )
+        census->n_calls += 1;
+    return WALK_CONTINUE;
+}
+
+
+static int
+count_uses ( node_t **slot, uint64_t depth, void *context )
+{
+    uses_t *uses = context;
+    if ( *slot != NULL && (*slot)->entry == uses->symbol )
+        uses->n_uses += 1;
+    return WALK_CONTINUE;
+}
+
+
+/* Calls are inlined on the way up, so that calls in the arguments are
+ * dealt with first
+ */
+static int
+inline_site ( node_t **slot, uint64_t depth, void *context )
+{
+    inliner_t *inliner = context;
+    node_t *node = *slot, *inlined = NULL;
+    callee_t *callee = NULL;
+    switch ( node->type )
+    {
+        case EXPRESSION:
+            if ( (callee = candidate ( inliner, node )) != NULL && callee->single )
+                inlined = substitute ( inliner, callee, node );
+            break;
+        case ASSIGNMENT_STATEMENT:
+            if ( (callee = candidate ( inliner, node->children[1] )) != NULL )
+                inlined = expand ( inliner, callee, node->children[1], node );
+            break;
+        case RETURN_STATEMENT:
+            if ( (callee = candidate ( inliner, node->children[0] )) != NULL )
+                inlined = expand ( inliner, callee, node->children[0], node );
+            break;
+        default:
+            break;
+    }
+    if ( inlined != NULL )
+    {
+        *slot = inlined;
+        inliner->budget -= callee->size;
+        inliner->changed = true;
+    }
+    return WALK_CONTINUE;
+}
+
+
+/* The callee, if the expression is a call of a candidate that fits
+ * in what is left of the budget
+ */
+static callee_t *
+candidate ( inliner_t *inliner, node_t *expression )
+{
+    if ( expression->type != EXPRESSION || expression->op != OP_NONE ||
+         expression->n_children != 2 )
+        return NULL;
+    symbol_t *function = expression->children[0]->entry;
+    callee_t *callee;
+    if ( function == NULL || function->type != SYM_FUNCTION ||
+         tlhash_lookup ( inliner->callees, &function, sizeof(function), (void **)&callee )
+             != TLHASH_SUCCESS ||
+         callee->size > inliner->budget )
+        return NULL;
+    node_t *arguments = expression->children[1];
+    uint64_t n_arguments = ( arguments != NULL ) ? arguments->n_children : 0;
+    return ( n_arguments == function->nparms ) ? callee : NULL;
+}
+
+
+/* The returned expression with the arguments for the parameters. The
+ * callee calls nothing, so an argument without calls may be evaluated
+ * where the parameter is used without reordering any effects; one that
+ * is used more than once has to be cheap to evaluate again, and one
+ * that is not used at all must not be able to trap.
+ * Returns NULL if the call is to be left as it is.
+ */
+static node_t *
+substitute ( inliner_t *inliner, callee_t *callee, node_t *call )
+{
+    node_t *arguments = call->children[1];
+    for ( size_t p=0; p<callee->function->nparms; p++ )
+    {
+        node_t *argument = arguments->children[p];
+        uses_t uses = { .symbol = parameter ( callee, p ), .n_uses = 0 };
+        tree_walk ( &callee->value, count_uses, NULL, &uses );
+        if ( has_call ( argument ) || (uses.n_uses > 1 && !is_trivial ( argument )) ||
+             (uses.n_uses == 0 && !is_pure ( argument )) )
+            return NULL;
+    }
+    inliner->callee = callee;
+    inliner->arguments = ( arguments != NULL ) ? arguments->children : NULL;
+    inliner->renamed = NULL;
+    return copy ( inliner, callee->value );
+}
+
+
+/* begin var f.p, ... f.p := argument ... body end, where the body's
+ * final return becomes the statement the call was the value of
+ */
+static node_t *
+expand ( inliner_t *inliner, callee_t *callee, node_t *call, node_t *statement )
+{
+    size_t n_parameters = callee->function->nparms;
+    symbol_t **renamed = calloc ( callee->n_symbols + 1, sizeof(symbol_t *) );
+    if ( renamed == NULL )
+        return NULL;
+
+    /* Parameters are numbered first, then the locals as declared */
+    const char *prefix = callee->function->name->text;
+    for ( size_t s=0; s<callee->n_symbols; s++ )
+    {
+        symbol_t *symbol = callee->symbols[s];
+        size_t seq = symbol->seq;
+        if ( symbol->type == SYM_LOCAL_VAR )
+            seq += n_parameters;
+        char name[strlen ( prefix ) + symbol->name->length + 2];
+        snprintf ( name, sizeof(name), "%s.%s", prefix, symbol->name->text );
+        renamed[s] = add_local (
+            inliner->ctx, inliner->caller, name,
+            inliner->scope + callee->scopes[s], inliner->seq + seq
+        );
+        if ( renamed[s] == NULL )
+        {
+            free ( renamed );
+            return NULL;
+        }
+    }
+    inliner->scope += callee->max_scope;
+    inliner->seq += callee->n_symbols;
+
+    arena_t *arena = inliner->arena;
+    node_t *arguments = call->children[1];
+    node_t *names = make_list ( arena, VARIABLE_LIST, n_parameters + 1 );
+    node_t *statements = make_list ( arena, STATEMENT_LIST, n_parameters + 1 );
+    for ( size_t s=0; s<callee->n_symbols; s++ )
+    {
+        if ( callee->symbols[s]->type != SYM_PARAMETER )
+            continue;
+        size_t p = callee->symbols[s]->seq;
+        names->children[p] = renamed[s]->node;
+        node_t *assignment = arena_alloc ( arena, sizeof(node_t) );
+        node_init (
+            assignment, arena, ASSIGNMENT_STATEMENT, NULL, 2,
+            make_reference ( arena, renamed[s] ), arguments->children[p]
+        );
+        statements->children[p] = assignment;
+    }
+    names->n_children = statements->n_children = n_parameters;
+
+    inliner->callee = callee;
+    inliner->arguments = NULL;
+    inliner->renamed = renamed;
+    node_t *body = copy ( inliner, callee->body );
+    free ( renamed );
+
+    /* The copy's final return, which is the body itself or ends it */
+    node_t **last = &body;
+    if ( body->type == BLOCK )
+    {
+        node_t *list = body->children[body->n_children - 1];
+        last = &list->children[list->n_children - 1];
+    }
+    if ( statement->type == ASSIGNMENT_STATEMENT )
+    {
+        node_t *assignment = arena_alloc ( arena, sizeof(node_t) );
+        node_init (
+            assignment, arena, ASSIGNMENT_STATEMENT, NULL, 2,
+            statement->children[0], (*last)->children[0]
+        );
+        *last = assignment;
+    }
+    if ( n_parameters == 0 )
+        return body;
+    statements->children[statements->n_children++] = body;
+
+    return make_declaring_block ( arena, names, statements );
+}
+
+
+/* Copies a subtree of the callee, which is small enough to recurse on.
+ * Its parameters and locals become the arguments or the fresh locals;
+ * the identifiers declaring its locals become those declaring the
+ * fresh ones.
+ */
+static node_t *
+copy ( inliner_t *inliner, node_t *node )
+{
+    if ( node == NULL )
+        return NULL;
+    if ( node->type == IDENTIFIER_DATA )
+    {
+        callee_t *callee = inliner->callee;
+        for ( size_t s=0; s<callee->n_symbols; s++ )
+        {
+            symbol_t *symbol = callee->symbols[s];
+            if ( node->entry != symbol && node != symbol->node )
+                continue;
+            if ( inliner->renamed != NULL )
+                return ( node == symbol->node ) ? inliner->renamed[s]->node :
+                    make_reference ( inliner->arena, inliner->renamed[s] );
+            node_t *argument = inliner->arguments[symbol->seq];
+            if ( !is_trivial ( argument ) )
+                return argument;
+            node = argument;
+            break;
+        }
+    }
+
+    node_t *duplicate = arena_alloc ( inliner->arena, sizeof(node_t) );
+    *duplicate = *node;
+    if ( node->type == NUMBER_DATA )
+    {
+        duplicate->data = arena_alloc ( inliner->arena, sizeof(int64_t) );
+        *((int64_t *) duplicate->data) = *((int64_t *) node->data);
+    }
+    duplicate->children = arena_alloc ( inliner->arena, node->n_children * sizeof(node_t *) );
+    for ( uint64_t c=0; c<node->n_children; c++ )
+        duplicate->children[c] = copy ( inliner, node->children[c] );
+    return duplicate;
+}
+
+
+static symbol_t *
+parameter ( callee_t *callee, size_t p )
+{
+    for ( size_t s=0; s<callee->n_symbols; s++ )
+        if ( callee->symbols[s]->type == SYM_PARAMETER && callee->symbols[s]->seq == p )
+            return callee->symbols[s];
+    return NULL;
+}
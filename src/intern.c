@@ -0,0 +1,112 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <intern.h>
+#include <tlhash.h>
+
+/* The pool doubles when it becomes more than half full */
+#define MAX_LOAD(n_slots) ((n_slots) / 2)
+
+static int grow ( intern_pool_t *pool );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Initializer - n_slots is rounded up to a power of two
+ * Returns
+ *  ENOMEM - if allocation of the slot array fails.
+ */
+int
+intern_init ( intern_pool_t *pool, size_t n_slots )
+{
+    size_t n = 16;
+    while ( n < n_slots )
+        n *= 2;
+    pool->n_slots = n;
+    pool->size = 0;
+    pool->slots = (ident_t **) calloc ( n, sizeof(ident_t *) );
+    if ( pool->slots == NULL )
+        return INTERN_ENOMEM;
+    arena_init ( &pool->storage, 0 );
+    return INTERN_SUCCESS;
+}
+
+
+/* Finalizer - invalidates every handle obtained from the pool */
+void
+intern_finalize ( intern_pool_t *pool )
+{
+    free ( pool->slots );
+    pool->slots = NULL;
+    pool->n_slots = pool->size = 0;
+    arena_release ( &pool->storage );
+}
+
+
+/* Lookup-or-insert - returns the unique handle for text, hashing it
+ * once with the tlhash backend.
+ * Returns NULL if the pool runs out of memory.
+ */
+ident_t *
+intern ( intern_pool_t *pool, const char *text )
+{
+    size_t length = strlen ( text );
+    uint32_t hash = tlhash_hash ( text, length );
+    size_t mask = pool->n_slots - 1, i = hash & mask;
+    ident_t *id;
+
+    while ( (id = pool->slots[i]) != NULL )
+    {
+        if ( id->hash == hash && id->length == length &&
+             ! memcmp ( id->text, text, length ) )
+            return id;
+        i = (i + 1) & mask;
+    }
+
+    id = arena_alloc ( &pool->storage, sizeof(ident_t) + length + 1 );
+    if ( id == NULL )
+        return NULL;
+    id->hash = hash;
+    id->length = length;
+    memcpy ( id->text, text, length + 1 );
+    pool->slots[i] = id;
+    pool->size += 1;
+    if ( pool->size > MAX_LOAD(pool->n_slots) && grow ( pool ) )
+        return NULL;
+    return id;
+}
+
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Rehash into twice as many slots, reusing the stored hashes */
+static int
+grow ( intern_pool_t *pool )
+{
+    size_t n_slots = pool->n_slots * 2, mask = n_slots - 1;
+    ident_t **slots = (ident_t **) calloc ( n_slots, sizeof(ident_t *) );
+    if ( slots == NULL )
+        return INTERN_ENOMEM;
+    for ( size_t s=0; s<pool->n_slots; s++ )
+    {
+        ident_t *id = pool->slots[s];
+        if ( id == NULL )
+            continue;
+        size_t i = id->hash & mask;
+        while ( slots[i] != NULL )
+            i = (i + 1) & mask;
+        slots[i] = id;
+    }
+    free ( pool->slots );
+    pool->slots = slots;
+    pool->n_slots = n_slots;
+    return INTERN_SUCCESS;
+}
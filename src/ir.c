@@ -2,152 +2,237 @@
 #include "ir.h"
 #include "tlhash.h"
 
-// Externally visible, for the generator
-extern tlhash_t *global_names;
-extern char **string_list;
-extern size_t n_string_list, stringc;
-
-uint64_t func_count = 0;
-uint64_t scope_id = 0;
-scope_frame global_scope = {
-    .enclosing = NULL,
-    .value = 0,
-    .depth = 0};
+static int bind_enter(node_t **slot, uint64_t depth, void *context);
+static int bind_leave(node_t **slot, uint64_t depth, void *context);
+static void push_scope(bind_state_t *state);
+static void bind_function(size_t index, void *jobs);
+static void merge_bindings(vslc_context_t *ctx, bind_result_t *result);
+
+// Below this many functions per thread, starting threads costs more than it saves
+#define FUNCTIONS_PER_THREAD 8
+
+// One function to bind on a worker thread
+typedef struct
+{
+    vslc_context_t *ctx;
+    symbol_t **functions;
+    bind_result_t *results;
+} bind_jobs_t;
+
 /* External interface */
 
-void create_symbol_table(void)
+void create_symbol_table(vslc_context_t *ctx)
 {
-    find_globals();
-    size_t n_globals = tlhash_size(global_names);
-    symbol_t *global_list[n_globals];
-    tlhash_values(global_names, (void **)&global_list);
+    find_globals(ctx);
+    bind_functions(ctx);
+}
+
+/* Binds the names in every function, once find_globals has run */
+void bind_functions(vslc_context_t *ctx)
+{
+    size_t n_globals = tlhash_size(ctx->global_names);
+    symbol_t **global_list = malloc(n_globals * sizeof(symbol_t *));
+    tlhash_values(ctx->global_names, (void **)global_list);
+
+    // Functions only share the (by now read-only) globals, so they are bound
+    // independently, and their strings and messages merged in source order
+    size_t n_functions = 0;
     for (size_t i = 0; i < n_globals; i++)
         if (global_list[i]->type == SYM_FUNCTION)
-            bind_names(global_list[i], global_list[i]->node);
+            global_list[n_functions++] = global_list[i];
+
+    bind_jobs_t jobs = {
+        .ctx = ctx,
+        .functions = global_list,
+        .results = calloc(n_functions, sizeof(bind_result_t))};
+    unsigned n_threads = n_functions / FUNCTIONS_PER_THREAD + 1;
+    if (n_threads > ctx->n_threads)
+        n_threads = ctx->n_threads;
+    parallel_for(n_functions, n_threads, bind_function, &jobs);
+
+    for (size_t f = 0; f < n_functions; f++)
+        merge_bindings(ctx, &jobs.results[f]);
+    free(jobs.results);
+    free(global_list);
 }
 
-void print_symbol_table(void)
+void print_symbol_table(vslc_context_t *ctx)
 {
-    print_symbols();
-    print_bindings(root);
+    print_symbols(ctx);
+    print_bindings(ctx, ctx->root);
 }
 
-void print_symbols(void)
+void print_symbols(vslc_context_t *ctx)
 {
-    printf("String table:\n");
-    for (size_t s = 0; s < stringc; s++)
-        printf("%zu: %s\n", s, string_list[s]);
-    printf("-- \n");
-
-    printf("Globals:\n");
-    size_t n_globals = tlhash_size(global_names);
-    symbol_t *global_list[n_globals];
-    tlhash_values(global_names, (void **)&global_list);
+    writer_t *out = &ctx->out;
+    writer_string(out, "String table:\n");
+    for (size_t s = 0; s < ctx->stringc; s++)
+    {
+        writer_uint(out, s);
+        writer_string(out, ": ");
+        writer_string(out, ctx->string_list[s]);
+        writer_char(out, '\n');
+    }
+    writer_string(out, "-- \n");
+
+    writer_string(out, "Globals:\n");
+    size_t n_globals = tlhash_size(ctx->global_names);
+    symbol_t **global_list = malloc(n_globals * sizeof(symbol_t *));
+    tlhash_values(ctx->global_names, (void **)global_list);
     for (size_t g = 0; g < n_globals; g++)
     {
         switch (global_list[g]->type)
         {
         case SYM_FUNCTION:
-            printf(
-                "%s: function %zu:\n",
-                global_list[g]->name, global_list[g]->seq);
+            writer_string(out, global_list[g]->name->text);
+            writer_string(out, ": function ");
+            writer_uint(out, global_list[g]->seq);
+            writer_string(out, ":\n");
             if (global_list[g]->locals != NULL)
             {
                 size_t localsize = tlhash_size(global_list[g]->locals);
-                printf(
-                    "\t%zu local variables, %zu are parameters:\n",
-                    localsize, global_list[g]->nparms);
-                symbol_t *locals[localsize];
+                writer_char(out, '\t');
+                writer_uint(out, localsize);
+                writer_string(out, " local variables, ");
+                writer_uint(out, global_list[g]->nparms);
+                writer_string(out, " are parameters:\n");
+                symbol_t **locals = malloc(localsize * sizeof(symbol_t *));
                 tlhash_values(global_list[g]->locals, (void **)locals);
                 for (size_t i = 0; i < localsize; i++)
                 {
-                    printf("\t%s: ", locals[i]->name);
+                    writer_char(out, '\t');
+                    writer_string(out, locals[i]->name->text);
                     switch (locals[i]->type)
                     {
                     case SYM_PARAMETER:
-                        printf("parameter %zu\n", locals[i]->seq);
+                        writer_string(out, ": parameter ");
                         break;
                     case SYM_LOCAL_VAR:
-                        printf("local var %zu\n", locals[i]->seq);
+                        writer_string(out, ": local var ");
                         break;
                     }
+                    writer_uint(out, locals[i]->seq);
+                    writer_char(out, '\n');
                 }
+                free(locals);
             }
             break;
         case SYM_GLOBAL_VAR:
-            printf("%s: global variable\n", global_list[g]->name);
+            writer_string(out, global_list[g]->name->text);
+            writer_string(out, ": global variable\n");
             break;
         }
     }
-    printf("-- \n");
+    free(global_list);
+    writer_string(out, "-- \n");
 }
 
-void print_bindings(node_t *root)
+/**
+ * One line of print_bindings: the symbol a node is linked to, or the index of its string
+ */
+static void print_link(vslc_context_t *ctx, symbol_t *entry, node_index_t type, size_t string_index)
 {
-    if (root == NULL)
-        return;
-    else if (root->entry != NULL)
+    writer_t *out = &ctx->out;
+    if (entry != NULL)
     {
-        switch (root->entry->type)
+        switch (entry->type)
         {
         case SYM_GLOBAL_VAR:
-            printf("Linked global var '%s'\n", root->entry->name);
-            break;
+            writer_string(out, "Linked global var '");
+            writer_string(out, entry->name->text);
+            writer_string(out, "'\n");
+            return;
         case SYM_FUNCTION:
-            printf("Linked function %zu ('%s')\n",
-                   root->entry->seq, root->entry->name);
+            writer_string(out, "Linked function ");
             break;
         case SYM_PARAMETER:
-            printf("Linked parameter %zu ('%s')\n",
-                   root->entry->seq, root->entry->name);
+            writer_string(out, "Linked parameter ");
             break;
         case SYM_LOCAL_VAR:
-            printf("Linked local var %zu ('%s')\n",
-                   root->entry->seq, root->entry->name);
+            writer_string(out, "Linked local var ");
             break;
         }
+        writer_uint(out, entry->seq);
+        writer_string(out, " ('");
+        writer_string(out, entry->name->text);
+        writer_string(out, "')\n");
     }
-    else if (root->type == STRING_DATA)
+    else if (type == STRING_DATA)
     {
-        size_t string_index = *((size_t *)root->data);
-        if (string_index < stringc)
-            printf("Linked string %zu\n", *((size_t *)root->data));
+        if (string_index < ctx->stringc)
+        {
+            writer_string(out, "Linked string ");
+            writer_uint(out, string_index);
+            writer_char(out, '\n');
+        }
         else
-            printf("(Not an indexed string)\n");
+            writer_string(out, "(Not an indexed string)\n");
+    }
+}
+
+static int print_binding(node_t **slot, uint64_t depth, void *context)
+{
+    node_t *root = *slot;
+    if (root != NULL && (root->entry != NULL || root->type == STRING_DATA))
+        print_link(
+            context, root->entry, root->type,
+            (root->entry == NULL) ? *((size_t *)root->data) : 0);
+    return WALK_CONTINUE;
+}
+
+void print_bindings(vslc_context_t *ctx, node_t *root)
+{
+    tree_walk(&root, print_binding, NULL, ctx);
+}
+
+/**
+ * Same output as print_bindings, from the flat tree. Its nodes are stored
+ * in pre-order, so this is a plain scan of the node array.
+ */
+void print_flat_bindings(vslc_context_t *ctx, flat_tree_t *tree)
+{
+    for (flat_index_t n = 0; n < tree->n_nodes; n++)
+    {
+        flat_node_t *node = &tree->nodes[n];
+        symbol_t *entry = (tree->entries != NULL) ? tree->entries[n] : NULL;
+        if (entry == NULL && node->type == STRING_DATA && !(node->flags & FLAT_STRING_INDEX))
+            writer_string(&ctx->out, "(Not an indexed string)\n");
+        else if (entry != NULL || node->type == STRING_DATA)
+            print_link(ctx, entry, node->type, node->data.string);
     }
-    for (size_t c = 0; c < root->n_children; c++)
-        print_bindings(root->children[c]);
 }
 
 /**
  * Destroys entire symbol table
  */
-void destroy_symbol_table(void)
+void destroy_symbol_table(vslc_context_t *ctx)
 {
-    destroy_symtab(global_names);
+    destroy_symtab(ctx->global_names);
+    ctx->global_names = NULL;
 
     // Now clean up the global list of strings
-    for (int i = 0; i < stringc; i++)
-        free(string_list[i]);
-    free(string_list);
+    // The strings themselves are owned by the tree arena
+    free(ctx->string_list);
+    ctx->string_list = NULL;
 }
 
 /**
  * Finds and binds all global identfiers
  */
-void find_globals(void)
+void find_globals(vslc_context_t *ctx)
 {
     // Initialize the global symbol table because apparently that wasn't done in the skeleton code 😡
-    global_names = (tlhash_t *)malloc(sizeof(tlhash_t));
+    tlhash_t *global_names = ctx->global_names = (tlhash_t *)malloc(sizeof(tlhash_t));
     // Not expecting a massive amount of globals
     tlhash_init(global_names, 32);
 
-    node_t *node = root;
+    node_t *node = ctx->root;
+    uint64_t n_inserts = 0;
 
     // The root node should point to the global list pretty much immediately
     while (node->type != GLOBAL_LIST)
     {
-        node = root->children[0];
+        node = ctx->root->children[0];
     }
 
     // Globals are the children of the GLOBAL_LIST
@@ -170,16 +255,16 @@ void find_globals(void)
                 {
                     node_t *identifier = global_child->children[k];
                     symbol_t *symbol = (symbol_t *)malloc(sizeof(symbol_t));
-                    symbol->name = strdup(identifier->data);
+                    symbol->name = identifier->data;
                     symbol->type = SYM_GLOBAL_VAR;
                     symbol->node = identifier;
                     symbol->locals = NULL;
 
-                    void *key = get_id_key(&global_scope, symbol->name);
-                    uint64_t key_len = get_key_length(&global_scope, symbol->name);
+                    symbol_key_t key;
+                    uint32_t key_hash = make_symbol_key(&key, GLOBAL_SCOPE, symbol->name);
                     // Insert the symbol into the globals symbol table
-                    tlhash_insert(global_names, key, key_len, symbol);
-                    free(key);
+                    tlhash_insert_hashed(global_names, &key, sizeof(key), key_hash, symbol);
+                    n_inserts += 1;
                     // Update the node to have a pointer to its symbol table entry
                     #ifdef LINK_DECLARATIONS
                     identifier->entry = symbol;
@@ -200,9 +285,9 @@ void find_globals(void)
                 if (global_child->type == IDENTIFIER_DATA)
                 {
                     symbol_t *func_symbol = (symbol_t *)malloc(sizeof(symbol_t));
-                    func_symbol->name = strdup(global_child->data);
+                    func_symbol->name = global_child->data;
                     func_symbol->type = SYM_FUNCTION;
-                    func_symbol->seq = func_count++;
+                    func_symbol->seq = ctx->func_count++;
                     func_symbol->node = global_node;
                     func_symbol->nparms = 0;
                     // Alloc and init a new hashtable for function locals
@@ -210,11 +295,11 @@ void find_globals(void)
                     tlhash_init(func_symbol->locals, 64);
 
                     // Insert into the globals table
-                    void *key = get_id_key(&global_scope, func_symbol->name);
-                    uint64_t key_len = get_key_length(&global_scope, func_symbol->name);
+                    symbol_key_t key;
+                    uint32_t key_hash = make_symbol_key(&key, GLOBAL_SCOPE, func_symbol->name);
                     // Insert the symbol into the globals symbol table
-                    tlhash_insert(global_names, key, key_len, func_symbol);
-                    free(key);
+                    tlhash_insert_hashed(global_names, &key, sizeof(key), key_hash, func_symbol);
+                    n_inserts += 1;
                     #ifdef LINK_DECLARATIONS
                     global_child->entry = func_symbol;
                     #endif
@@ -225,21 +310,37 @@ void find_globals(void)
         }
         }
     }
+    if (ctx->stats != NULL)
+        ctx->stats->n_inserts += n_inserts;
 }
 
 /**
- * Binds all symbol references in function.
+ * Binds all symbol references in function. Touches nothing but the function's
+ * own symbols and subtree, so functions can be bound concurrently.
+ * @param ctx Compilation the function belongs to
  * @param function Function symbol whose local scope is to be populated
  * @param root Syntax tree node representing function
+ * @param result Receives the function's strings and messages, for merge_bindings
  */
-void bind_names(symbol_t *function, node_t *root)
+void bind_names(vslc_context_t *ctx, symbol_t *function, node_t *root, bind_result_t *result)
 {
-    scope_id++;
-    scope_frame scope;
-    scope.depth = 1;
-    scope.enclosing = NULL;
-    scope.value = scope_id;
-    scope_id++;
+    bind_state_t state;
+    state.ctx = ctx;
+    state.function = function;
+    state.result = result;
+    state.seq_num = 0;
+    state.scope_id = 0;
+    state.n_scopes = 0;
+    state.max_scopes = 16;
+    state.scopes = malloc(state.max_scopes * sizeof(scope_frame));
+    scope_table_init(&state.names);
+
+    // Messages are held back until the functions before this one have printed theirs
+    result->out = open_memstream(&result->messages, &result->messages_size);
+    if (result->out == NULL)
+        result->out = stderr;
+
+    push_scope(&state);
 
     // Parameters are given as the 2nd child in a VARIABLE_LIST node
     node_t *param_list = root->children[1];
@@ -253,7 +354,7 @@ void bind_names(symbol_t *function, node_t *root)
         {
             node_t *param_node = param_list->children[i];
             symbol_t *param = malloc(sizeof(symbol_t));
-            param->name = strdup(param_node->data);
+            param->name = param_node->data;
             param->type = SYM_PARAMETER;
             param->seq = i;
             param->nparms = 0;
@@ -263,21 +364,69 @@ void bind_names(symbol_t *function, node_t *root)
             param_node->entry = param;
             #endif
 
-            void *key = get_id_key(&scope, param->name);
-            uint64_t key_len = get_key_length(&scope, param->name);
-            tlhash_insert(function->locals, key, key_len, param);
-            free(key);
+            declare_local(function, param, &state.scopes[0], &state.names);
+            result->n_inserts += 1;
+        }
+    }
+
+    int status = bind_declarations(function, root, &state);
+    result->n_lookups += state.names.n_lookups;
+    if (ctx->scope_tables != NULL)
+        scope_table_stats(&state.names, &result->names);
+    scope_table_finalize(&state.names);
+    free(state.scopes);
+    if (status != 0)
+        fprintf(result->out, "Couldn't bind local variables\n");
+    if (result->out != stderr)
+        fclose(result->out);
+    result->out = NULL;
+}
+
+/**
+ * Task for parallel_for: binds the index'th function
+ */
+static void bind_function(size_t index, void *jobs)
+{
+    bind_jobs_t *j = jobs;
+    symbol_t *function = j->functions[index];
+    bind_names(j->ctx, function, function->node, &j->results[index]);
+}
+
+/**
+ * Appends one function's strings to the string table, and prints its messages.
+ * Done in function order, this numbers strings in source order.
+ */
+static void merge_bindings(vslc_context_t *ctx, bind_result_t *result)
+{
+    for (size_t i = 0; i < result->n_strings; i++)
+    {
+        node_t *string = result->strings[i];
+        if (ctx->stringc >= ctx->n_string_list)
+        {
+            // Dynamically increase string list size as needed
+            ctx->n_string_list *= 2;
+            ctx->string_list = realloc(ctx->string_list, ctx->n_string_list * sizeof(char *));
         }
+
+        // Move the string from the node data into the string list and replace the node data with its ID
+        ctx->string_list[ctx->stringc] = string->data;
+        string->data = arena_alloc(&ctx->tree_arena, sizeof(size_t));
+        *(size_t *)string->data = ctx->stringc;
+        ctx->stringc += 1;
     }
+    free(result->strings);
+    if (ctx->stats != NULL)
+    {
+        ctx->stats->n_lookups += result->n_lookups;
+        ctx->stats->n_inserts += result->n_inserts;
+    }
+    if (ctx->scope_tables != NULL)
+        stats_add_table(ctx->scope_tables, &result->names);
 
-    // calloc sets the allocated region to 0 for us, so *seq_number = 0 right off the bat
-    size_t *seq_number = (size_t *) calloc(1, sizeof(size_t));
-    int result = bind_declarations(function, root, seq_number, &scope);
-    free(seq_number);
-    if (result != 0)
+    if (result->messages != NULL)
     {
-        printf("Couldn't bind local variables\n");
-        return;
+        writer_bytes(&ctx->out, result->messages, result->messages_size);
+        free(result->messages);
     }
 }
 
@@ -286,14 +435,28 @@ void bind_names(symbol_t *function, node_t *root)
  * and bind all symbol references. Also updates string table.
  * @param function Function symbol to begin with
  * @param root Syntax tree node representing `function`
- * @param seq_num Memory area used for generating unique sequence numbers
- * @param scope_stack Initial scope. Should have depth=1, enclosing=NULL and a unique value
+ * @param state Sequence number counter, open scopes and the names visible in them.
+ *              Should hold the function's own scope, with its parameters declared
  * @returns 0 on success 
  **/
-int bind_declarations(symbol_t *function, node_t *root, size_t *seq_num, scope_frame *scope_stack)
+int bind_declarations(symbol_t *function, node_t *root, bind_state_t *state)
+{
+    state->function = function;
+    return tree_walk(&root, bind_enter, bind_leave, state);
+}
+
+/**
+ * Binding on the way down the tree.
+ * @returns How many leading children to skip, WALK_ABORT on an undeclared name,
+ *          or WALK_ENOMEM if a string cannot be kept
+ */
+static int bind_enter(node_t **slot, uint64_t depth, void *context)
 {
-    // Says what child of root recursion should begin at
-    int first_child = 0;
+    bind_state_t *state = context;
+    vslc_context_t *ctx = state->ctx;
+    node_t *root = *slot;
+    if (root == NULL)
+        return WALK_CONTINUE;
 
     // Actually perform the binding on various types of nodes
     switch (root->type)
@@ -301,155 +464,286 @@ int bind_declarations(symbol_t *function, node_t *root, size_t *seq_num, scope_f
     case FUNCTION:
     {
         // Skips linking function definition and parameter declarations
-        first_child = 2;
-        break;
+        return 2;
     }
     case DECLARATION:
     {
         // Skips linking declarations
-        first_child = root->n_children;
         node_t *var_list = root->children[0];
+        scope_frame *scope = &state->scopes[state->n_scopes - 1];
         for (int i = 0; i < var_list->n_children; i++)
         {
             node_t *id_data = var_list->children[i];
             symbol_t *var = malloc(sizeof(symbol_t));
-            var->name = strdup(id_data->data);
+            var->name = id_data->data;
             var->type = SYM_LOCAL_VAR;
-            var->seq = *seq_num++;
+            var->seq = state->seq_num;
             var->nparms = 0;
             var->locals = NULL;
             var->node = id_data;
+
+            // Hash the local variable into the symbol table based on both identifier and scope
+            state->result->n_inserts += 1;
+            if (declare_local(state->function, var, scope, &state->names) != TLHASH_SUCCESS)
+            {
+                // Redeclared in the same scope, references keep binding to the first one
+                free(var);
+                continue;
+            }
+            state->seq_num++;
             #ifdef LINK_DECLARATIONS
             id_data->entry = var;
             #endif
-
-            // Hash the local variable into the symbol table based on both identifier and scope
-            void *key = get_id_key(scope_stack, var->name);
-            uint64_t key_len = get_key_length(scope_stack, var->name);
-            tlhash_insert(function->locals, key, key_len, var);
-            free(key);
         }
-        break;
+        return WALK_SKIP_CHILDREN;
     }
     case STRING_DATA:
     {
-        if (stringc >= n_string_list)
+        // Numbered when the function's strings are merged into the string table
+        bind_result_t *result = state->result;
+        if (result->n_strings == result->max_strings)
         {
-            if (string_list == NULL)
-            {
-                return -1;
-            }
-
-            // Dynamically increase string list size as needed
-            n_string_list *= 2;
-            string_list = realloc(string_list, n_string_list * sizeof(char *));
+            // The strings so far stay in the result, to be merged and freed as usual
+            size_t max_strings = (result->max_strings > 0) ? 2 * result->max_strings : 8;
+            node_t **strings = realloc(result->strings, max_strings * sizeof(node_t *));
+            if (strings == NULL)
+                return WALK_ENOMEM;
+            result->strings = strings;
+            result->max_strings = max_strings;
         }
-
-        // Move the string from the node data into the string list and replace the node data with its ID
-        string_list[stringc] = root->data;
-        root->data = malloc(sizeof(size_t));
-        *(size_t *)root->data = stringc;
-        stringc += 1;
+        result->strings[result->n_strings++] = root;
         break;
     }
     case IDENTIFIER_DATA:
     {
-        int result;
-        void **symbol_ptr = malloc(sizeof(symbol_t *));
-        // Move up through scopes, looking for the closest declaration of the variable being used
-        scope_frame *s = scope_stack;
-        do
-        {
-            void *key = get_id_key(s, root->data);
-            uint64_t key_len = get_key_length(s, root->data);
-            result = tlhash_lookup(function->locals, key, key_len, symbol_ptr);
-            free(key);
-            if (result == TLHASH_ENOENT)
-                s = s->enclosing;
-        } while (result && s != NULL);
-
-        // If we didn't find a declaration in local scopes, try the global scope
-        if (result == TLHASH_ENOENT)
-        {
-            void *key = get_id_key(&global_scope, root->data);
-            uint64_t key_len = get_key_length(&global_scope, root->data);
-            result = tlhash_lookup(global_names, key, key_len, symbol_ptr);
-            free(key);
-        }
+        // The innermost visible declaration, falling back on the globals
+        symbol_t *symbol = resolve_name(ctx->global_names, &state->names, root->data);
+        // Every name probes the scope table, counted when binding ends; only
+        // names that are not local get as far as the globals table
+        if (symbol == NULL || symbol->type == SYM_GLOBAL_VAR || symbol->type == SYM_FUNCTION)
+            state->result->n_lookups += 1;
 
         // We found no declaration of the variable before this point
         // So the variable is being used before its declaration (if it even is declared anywhere)
-        if (*symbol_ptr == NULL)
+        if (symbol == NULL)
         {
-            printf("\033[31mSymbol \"%s\" used before declaration\033[0m\n", (char *)root->data);
-            return -1;
+            fprintf(state->result->out, "\033[31mSymbol \"%s\" used before declaration\033[0m\n", ((ident_t *)root->data)->text);
+            return WALK_ABORT;
         }
 
         // Link it to the appropriate symbol table entry
-        root->entry = *symbol_ptr;
-        free(symbol_ptr);
+        root->entry = symbol;
+        break;
+    }
+    case BLOCK:
+    {
+        // New block, new scope
+        push_scope(state);
         break;
     }
     }
+    return WALK_CONTINUE;
+}
 
-    // New block, new scope
-    if (root->type == BLOCK)
+/**
+ * Binding on the way back up: leaving a block uncovers whatever its declarations shadowed
+ */
+static int bind_leave(node_t **slot, uint64_t depth, void *context)
+{
+    bind_state_t *state = context;
+    if ((*slot)->type == BLOCK)
     {
-        scope_frame new_scope;
-        new_scope.enclosing = scope_stack;
-        new_scope.value = scope_id;
-        new_scope.depth = scope_stack->depth + 1;
-        scope_id++;
-        scope_stack = &new_scope;
+        state->n_scopes -= 1;
+        scope_table_leave(&state->names, state->scopes[state->n_scopes].mark);
     }
+    return WALK_CONTINUE;
+}
 
-    // Recursively traverse the tree, performing binding in all children
-    for (int i = first_child; i < root->n_children; i++)
+/**
+ * Opens a scope with a fresh scope value. Values only have to be unique within
+ * the function, as each function has a locals table of its own.
+ */
+static void push_scope(bind_state_t *state)
+{
+    if (state->n_scopes == state->max_scopes)
     {
-        if (root->children[i] != NULL)
-        {
-            if (bind_declarations(function, root->children[i], seq_num, scope_stack))
-            {
-                return -1;
-            };
-        }
+        state->max_scopes *= 2;
+        state->scopes = realloc(state->scopes, state->max_scopes * sizeof(scope_frame));
     }
+    state->scopes[state->n_scopes].value = ++state->scope_id;
+    state->scopes[state->n_scopes].mark = state->names.n_declared;
+    state->n_scopes += 1;
+}
 
-    return 0;
+/**
+ * Adds a parameter or local variable to the function's symbol table, and makes
+ * it the visible declaration of its name until the scope is left.
+ * @param function Function symbol that owns the local
+ * @param symbol Symbol for the declared name
+ * @param scope Scope the declaration appears in
+ * @param names Names visible at this point
+ * @returns TLHASH_EEXIST if the name is already declared in this scope
+ */
+int declare_local(symbol_t *function, symbol_t *symbol, scope_frame *scope, scope_table_t *names)
+{
+    symbol_key_t key;
+    uint32_t key_hash = make_symbol_key(&key, scope->value, symbol->name);
+    int result = tlhash_insert_hashed(function->locals, &key, sizeof(key), key_hash, symbol);
+    if (result == TLHASH_SUCCESS)
+        scope_table_declare(names, symbol);
+    return result;
+}
+
+/**
+ * Finds the declaration a name refers to without allocating: the innermost
+ * local declaration if there is one, the global one otherwise.
+ * @param globals Global symbol table
+ * @param names Names visible at this point
+ * @param name Interned identifier
+ * @returns The symbol, or NULL if the name is undeclared
+ */
+symbol_t *resolve_name(tlhash_t *globals, scope_table_t *names, ident_t *name)
+{
+    symbol_t *symbol = scope_table_lookup(names, name);
+    if (symbol == NULL)
+    {
+        symbol_key_t key;
+        uint32_t key_hash = make_symbol_key(&key, GLOBAL_SCOPE, name);
+        tlhash_lookup_hashed(globals, &key, sizeof(key), key_hash, (void **)&symbol);
+    }
+    return symbol;
 }
 
 /** 
- * Constructs a unique key for a variable identifier based on its scope
- * I.e. a key that (hopefully) won't cause hashtable collisions across scopes.
- * @param scope Scope of identifier
- * @param id Identifier string
+ * Constructs a unique key for an identifier declared in the given scope.
+ * Scope values are unique per block, and identifiers are interned, so the pair is
+ * unique and comparing keys compares names by pointer.
+ * @param key Key to fill in
+ * @param scope Scope value of the declaring block, GLOBAL_SCOPE for globals
+ * @param id Interned identifier
+ * @returns Hash of the key, mixed from the identifier's precomputed hash
 */
-void *get_id_key(scope_frame *scope, char *id)
+uint32_t make_symbol_key(symbol_key_t *key, uint64_t scope, ident_t *id)
+{
+    // Zero first, so padding bytes compare equal too
+    memset(key, 0, sizeof(*key));
+    key->scope = scope;
+    key->name = id;
+    uint64_t hash = (id->hash ^ scope) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/*
+ * Scoped name table: maps each name to its innermost visible declaration.
+ * Declarations made in a scope are remembered in order, and each symbol keeps
+ * the declaration it shadows, so leaving a scope just walks back the list.
+ * The slots are open-addressed on the identifiers' precomputed hashes, and
+ * a name's slot stays once created, so lookups never allocate.
+ */
+
+void scope_table_init(scope_table_t *names)
+{
+    names->n_slots = 64;
+    names->size = 0;
+    names->slots = calloc(names->n_slots, sizeof(scope_binding_t));
+    names->n_declared = 0;
+    names->max_declared = 16;
+    names->declared = malloc(names->max_declared * sizeof(symbol_t *));
+    names->n_lookups = 0;
+    names->n_hits = 0;
+}
+
+void scope_table_finalize(scope_table_t *names)
+{
+    free(names->slots);
+    free(names->declared);
+}
+
+static scope_binding_t *scope_table_slot(scope_table_t *names, ident_t *name)
+{
+    size_t mask = names->n_slots - 1, i = name->hash & mask;
+    while (names->slots[i].name != NULL && names->slots[i].name != name)
+        i = (i + 1) & mask;
+    return &names->slots[i];
+}
+
+symbol_t *scope_table_lookup(scope_table_t *names, ident_t *name)
 {
-    void *key = malloc(get_key_length(scope, id));
-    scope_frame *s = scope;
-    for (int i = 0; s != NULL; i++)
+    symbol_t *symbol = scope_table_slot(names, name)->symbol;
+    names->n_lookups += 1;
+    names->n_hits += (symbol != NULL);
+    return symbol;
+}
+
+void scope_table_declare(scope_table_t *names, symbol_t *symbol)
+{
+    // Keep the slots at most half full
+    if (2 * (names->size + 1) > names->n_slots)
+    {
+        scope_binding_t *old = names->slots;
+        size_t n_old = names->n_slots;
+        names->n_slots *= 2;
+        names->slots = calloc(names->n_slots, sizeof(scope_binding_t));
+        for (size_t i = 0; i < n_old; i++)
+            if (old[i].name != NULL)
+                *scope_table_slot(names, old[i].name) = old[i];
+        free(old);
+    }
+    if (names->n_declared == names->max_declared)
+    {
+        names->max_declared *= 2;
+        names->declared = realloc(names->declared, names->max_declared * sizeof(symbol_t *));
+    }
+
+    scope_binding_t *slot = scope_table_slot(names, symbol->name);
+    if (slot->name == NULL)
     {
-        // Place each scope ID (a uint64_t) after each other in the malloced memory region
-        // This is done to construct a unique "scope prefix" for the key
-        // Ignore the size_t cast. Compiler was complaining, it doesn't actually mean anything
-        *(uint64_t *)((size_t)key + i * sizeof(uint64_t)) = s->value;
-        s = s->enclosing;
+        slot->name = symbol->name;
+        names->size += 1;
+    }
+    symbol->shadowed = slot->symbol;
+    slot->symbol = symbol;
+    names->declared[names->n_declared++] = symbol;
+}
+
+void scope_table_leave(scope_table_t *names, size_t mark)
+{
+    while (names->n_declared > mark)
+    {
+        symbol_t *symbol = names->declared[--names->n_declared];
+        scope_table_slot(names, symbol->name)->symbol = symbol->shadowed;
     }
-    // Finally, place the identifier name after the scope prefix
-    strcpy((char *)((size_t)key + scope->depth * sizeof(uint64_t)), id);
-    return key;
 }
 
 /**
- * Returns the byte length of the unique key for the given identifier, based on the given scope
- * @param scope Scope of identifier
- * @param id Identifier string
+ * Reports the table as tlhash_stats does. Every name declared in the function
+ * still has its slot, so the shape is that of the whole function; a lookup
+ * compares identifier pointers, and its key is hashed when the name is interned.
  */
-uint64_t get_key_length(scope_frame *scope, char *id)
+void scope_table_stats(scope_table_t *names, tlhash_stats_t *stats)
 {
-    // Each scope ID is a uint64_t, and there are scope->depth such IDs
-    return sizeof(uint64_t) * scope->depth + strlen(id) + 1;
+    size_t mask = names->n_slots - 1, total = 0;
+    *stats = (tlhash_stats_t){
+        .size = names->size,
+        .n_slots = names->n_slots,
+        .load_factor = (double)names->size / names->n_slots,
+        .counted = 1,
+        .n_lookups = names->n_lookups,
+        .n_hits = names->n_hits,
+        .n_misses = names->n_lookups - names->n_hits,
+        .mean_bytes_hashed = (names->n_lookups > 0) ? sizeof(ident_t *) : 0};
+    for (size_t i = 0; i < names->n_slots; i++)
+    {
+        if (names->slots[i].name == NULL)
+            continue;
+        size_t length = ((i - names->slots[i].name->hash) & mask) + 1;
+        stats->probe_lengths[(length < TLHASH_PROBE_BUCKETS) ? length - 1 : TLHASH_PROBE_BUCKETS - 1] += 1;
+        if (length > stats->max_probe_length)
+            stats->max_probe_length = length;
+        total += length;
+    }
+    if (names->size > 0)
+        stats->mean_probe_length = (double)total / names->size;
 }
 
 /**
@@ -467,10 +761,11 @@ void destroy_symtab(tlhash_t *symtab)
     {
         symbol_t *symbol = symbols[k];
 
-        // Remove the reference to the symbol from the corresponding node
-        symbol->node->entry = NULL;
-        // Free all allocated data from the symbol
-        free(symbol->name);
+        // Remove the reference to the symbol from the corresponding node,
+        // symbols loaded from an image have none
+        if (symbol->node != NULL)
+            symbol->node->entry = NULL;
+        // The name is an interned handle, owned by the identifier pool
         // Recursively destroy local symtabs
         if (symbol->locals != NULL)
         {
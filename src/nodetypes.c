@@ -29,3 +29,21 @@ char *node_string[26] = {
     STRING(STRING_DATA)
 };
 #undef STRING
+
+char *operator_string[15] = {
+    "(null)",   /* What printing a NULL operator string used to produce */
+    "|",
+    "^",
+    "&",
+    ">>",
+    "<<",
+    "+",
+    "-",
+    "*",
+    "/",
+    "-",
+    "~",
+    "=",
+    "<",
+    ">"
+};
@@ -0,0 +1,279 @@
+#include <vslc.h>
+#include <optimize.h>
+
+static int find_call ( node_t **slot, uint64_t depth, void *context );
+static int find_effect ( node_t **slot, uint64_t depth, void *context );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+optimize ( vslc_context_t *ctx )
+{
+    size_t n_globals = tlhash_size ( ctx->global_names );
+    symbol_t **globals = malloc ( (n_globals + 1) * sizeof(symbol_t *) );
+    if ( globals == NULL )
+        return;
+    tlhash_values ( ctx->global_names, (void **)globals );
+    inline_calls ( ctx, globals, n_globals );
+    for ( size_t g=0; g<n_globals; g++ )
+    {
+        if ( globals[g]->type != SYM_FUNCTION )
+            continue;
+        eliminate_dead_code ( ctx, globals[g] );
+        eliminate_tail_calls ( ctx, globals[g] );
+        hoist_invariants ( ctx, globals[g] );
+        eliminate_common_subexpressions ( ctx, globals[g] );
+        reduce_strength ( ctx, globals[g] );
+    }
+    free ( globals );
+}
+
+
+/* A block without declarations or statements, for where the grammar
+ * wants a statement and none is left
+ */
+node_t *
+make_empty_block ( arena_t *arena )
+{
+    node_t *list = arena_alloc ( arena, sizeof(node_t) );
+    node_t *block = arena_alloc ( arena, sizeof(node_t) );
+    if ( list == NULL || block == NULL )
+        return NULL;
+    node_init ( list, arena, STATEMENT_LIST, NULL, 0 );
+    node_init ( block, arena, BLOCK, NULL, 1, list );
+    return block;
+}
+
+
+/* A block declaring the names of a VARIABLE_LIST, which may be empty,
+ * around a statement list
+ */
+node_t *
+make_declaring_block ( arena_t *arena, node_t *names, node_t *statements )
+{
+    node_t *block = arena_alloc ( arena, sizeof(node_t) );
+    if ( block == NULL )
+        return NULL;
+    if ( names->n_children == 0 )
+    {
+        node_init ( block, arena, BLOCK, NULL, 1, statements );
+        return block;
+    }
+    node_t *declaration = arena_alloc ( arena, sizeof(node_t) );
+    node_t *declarations = arena_alloc ( arena, sizeof(node_t) );
+    if ( declaration == NULL || declarations == NULL )
+        return NULL;
+    node_init ( declaration, arena, DECLARATION, NULL, 1, names );
+    node_init ( declarations, arena, DECLARATION_LIST, NULL, 1, declaration );
+    node_init ( block, arena, BLOCK, NULL, 2, declarations, statements );
+    return block;
+}
+
+
+/* A pre callback for tree_walk that keeps a walk to the statements: it
+ * goes into blocks, statement lists and the bodies of if and while
+ * statements, and into nothing else
+ */
+int
+skip_expressions ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *node = *slot;
+    if ( node == NULL )
+        return WALK_CONTINUE;
+    switch ( node->type )
+    {
+        case IF_STATEMENT: case WHILE_STATEMENT:
+            return 1;
+        case BLOCK: case STATEMENT_LIST:
+            return WALK_CONTINUE;
+        default:
+            return WALK_SKIP_CHILDREN;
+    }
+}
+
+
+/* An empty list node with room for n children */
+node_t *
+make_list ( arena_t *arena, node_index_t type, uint64_t n )
+{
+    node_t *list = arena_alloc ( arena, sizeof(node_t) );
+    if ( list == NULL )
+        return NULL;
+    node_init ( list, arena, type, NULL, 0 );
+    list->children = arena_alloc ( arena, n * sizeof(node_t *) );
+    return list;
+}
+
+
+/* An identifier bound to the symbol */
+node_t *
+make_reference ( arena_t *arena, symbol_t *symbol )
+{
+    node_t *identifier = arena_alloc ( arena, sizeof(node_t) );
+    if ( identifier == NULL )
+        return NULL;
+    node_init ( identifier, arena, IDENTIFIER_DATA, symbol->name, 0 );
+    identifier->entry = symbol;
+    return identifier;
+}
+
+
+/* The largest scope value the function's locals are keyed on, and how
+ * many local variables it has; locals a pass adds go after both
+ */
+bool
+local_extent ( symbol_t *function, uint64_t *scope, size_t *seq )
+{
+    tlhash_t *locals = function->locals;
+    size_t n_locals = tlhash_size ( locals );
+    symbol_t **symbols = malloc ( (n_locals + 1) * sizeof(symbol_t *) );
+    symbol_key_t **keys = malloc ( (n_locals + 1) * sizeof(symbol_key_t *) );
+    if ( symbols == NULL || keys == NULL )
+    {
+        free ( symbols );
+        free ( keys );
+        return false;
+    }
+    tlhash_values ( locals, (void **)symbols );
+    tlhash_keys ( locals, (void **)keys );
+    *scope = GLOBAL_SCOPE;
+    *seq = 0;
+    for ( size_t l=0; l<n_locals; l++ )
+    {
+        if ( keys[l]->scope > *scope )
+            *scope = keys[l]->scope;
+        if ( symbols[l]->type == SYM_LOCAL_VAR )
+            *seq += 1;
+    }
+    free ( symbols );
+    free ( keys );
+    return true;
+}
+
+
+/* Adds a local variable to the function's table, with the identifier
+ * that declares it as its node. Names that are not VSL identifiers
+ * keep locals made up by a pass apart from the program's own.
+ * Returns NULL if it could not be added.
+ */
+symbol_t *
+add_local ( vslc_context_t *ctx, symbol_t *function, const char *name, uint64_t scope, size_t seq )
+{
+    symbol_t *local = malloc ( sizeof(symbol_t) );
+    if ( local == NULL )
+        return NULL;
+    *local = (symbol_t) {
+        .name = intern ( &ctx->identifiers, name ),
+        .type = SYM_LOCAL_VAR,
+        .seq = seq,
+        .nparms = 0,
+        .locals = NULL,
+        .node = NULL,
+        .shadowed = NULL
+    };
+    symbol_key_t key;
+    if ( local->name == NULL ||
+         (local->node = make_reference ( &ctx->tree_arena, local )) == NULL ||
+         tlhash_insert_hashed (
+             function->locals, &key, sizeof(key),
+             make_symbol_key ( &key, scope, local->name ), local
+         ) != TLHASH_SUCCESS )
+    {
+        free ( local );
+        return NULL;
+    }
+    #ifndef LINK_DECLARATIONS
+    local->node->entry = NULL;
+    #endif
+    return local;
+}
+
+
+/* Whether evaluating the expression may call a function, and so have
+ * effects beyond its value
+ */
+bool
+has_call ( node_t *expression )
+{
+    return tree_walk ( &expression, find_call, NULL, NULL ) == WALK_ABORT;
+}
+
+
+/* Whether the expression may be left unevaluated: it calls nothing,
+ * and only divides by constants other than 0 and -1, so it cannot trap
+ */
+bool
+is_pure ( node_t *expression )
+{
+    return tree_walk ( &expression, find_effect, NULL, NULL ) != WALK_ABORT;
+}
+
+
+/* Evaluating it again costs no more than using a copy of its value */
+bool
+is_trivial ( node_t *expression )
+{
+    return expression->type == NUMBER_DATA || expression->type == IDENTIFIER_DATA;
+}
+
+
+/* Whether control never gets past the statement */
+bool
+always_returns ( node_t *statement )
+{
+    switch ( statement->type )
+    {
+        case RETURN_STATEMENT:
+            return true;
+        case BLOCK:
+        {
+            node_t *statements = statement->children[statement->n_children - 1];
+            return statements->n_children > 0 &&
+                always_returns ( statements->children[statements->n_children - 1] );
+        }
+        case IF_STATEMENT:
+            return statement->n_children > 2 &&
+                always_returns ( statement->children[1] ) &&
+                always_returns ( statement->children[2] );
+        default:
+            return false;
+    }
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static int
+find_call ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *node = *slot;
+    if ( node != NULL && node->type == EXPRESSION && node->op == OP_NONE && node->n_children == 2 )
+        return WALK_ABORT;
+    return WALK_CONTINUE;
+}
+
+
+static int
+find_effect ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *node = *slot;
+    if ( node == NULL || node->type != EXPRESSION )
+        return WALK_CONTINUE;
+    if ( node->op == OP_NONE && node->n_children == 2 )
+        return WALK_ABORT;
+    if ( node->op == OP_DIV )
+    {
+        node_t *divisor = node->children[1];
+        if ( divisor->type != NUMBER_DATA || *((int64_t *) divisor->data) == 0 ||
+             *((int64_t *) divisor->data) == -1 )
+            return WALK_ABORT;
+    }
+    return WALK_CONTINUE;
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <parallel.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t next, n_tasks;
+    parallel_task_fn task;
+    void *arg;
+} work_t;
+
+static void *worker ( void *work );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Returns
+ *  SUCCESS - every task has run
+ *  ETHREAD - threads could not be started; every task has still run,
+ *            on the threads that could
+ */
+int
+parallel_for (
+    size_t n_tasks, unsigned n_threads, parallel_task_fn task, void *arg
+) {
+    work_t work = {
+        .next = 0, .n_tasks = n_tasks, .task = task, .arg = arg
+    };
+    if ( n_threads > n_tasks )
+        n_threads = n_tasks;
+    if ( n_threads <= 1 )
+    {
+        for ( size_t i=0; i<n_tasks; i++ )
+            task ( i, arg );
+        return PARALLEL_SUCCESS;
+    }
+
+    pthread_mutex_init ( &work.lock, NULL );
+    pthread_t *threads = malloc ( (n_threads-1) * sizeof(pthread_t) );
+    unsigned started = 0;
+    if ( threads != NULL )
+        while ( started < n_threads-1 &&
+            pthread_create ( &threads[started], NULL, worker, &work ) == 0
+        )
+            started += 1;
+
+    worker ( &work );
+    for ( unsigned t=0; t<started; t++ )
+        pthread_join ( threads[t], NULL );
+    free ( threads );
+    pthread_mutex_destroy ( &work.lock );
+    return ( started == n_threads-1 ) ? PARALLEL_SUCCESS : PARALLEL_ETHREAD;
+}
+
+
+/* Online processors, at least 1 */
+unsigned
+parallel_cpus ( void )
+{
+    long n = sysconf ( _SC_NPROCESSORS_ONLN );
+    return ( n > 0 ) ? (unsigned) n : 1;
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static void *
+worker ( void *arg )
+{
+    work_t *work = arg;
+    for ( ;; )
+    {
+        pthread_mutex_lock ( &work->lock );
+        size_t i = work->next;
+        if ( i < work->n_tasks )
+            work->next += 1;
+        pthread_mutex_unlock ( &work->lock );
+        if ( i >= work->n_tasks )
+            return NULL;
+        work->task ( i, work->arg );
+    }
+}
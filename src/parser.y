@@ -1,19 +1,31 @@
 %{
 #include <vslc.h>
 
+/* Nodes belong to the tree arena of the compilation being parsed */
+#define ARENA (&ctx->tree_arena)
 #define N0C(n,t,d) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 0 ); \
+    node_init ( n = arena_alloc(ARENA, sizeof(node_t)), ARENA, t, d, 0 ); \
 } while ( false )
 #define N1C(n,t,d,a) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 1, a ); \
+    node_init ( n = arena_alloc(ARENA, sizeof(node_t)), ARENA, t, d, 1, a ); \
 } while ( false )
 #define N2C(n,t,d,a,b) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 2, a, b ); \
+    node_init ( n = arena_alloc(ARENA, sizeof(node_t)), ARENA, t, d, 2, a, b ); \
 } while ( false )
 #define N3C(n,t,d,a,b,c) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 3, a, b, c ); \
+    node_init ( n = arena_alloc(ARENA, sizeof(node_t)), ARENA, t, d, 3, a, b, c ); \
+} while ( false )
+/* Operator nodes carry their operator in node->op instead of data */
+#define N1O(n,t,o,a) do { \
+    N1C ( n, t, NULL, a ); n->op = o; \
+} while ( false )
+#define N2O(n,t,o,a,b) do { \
+    N2C ( n, t, NULL, a, b ); n->op = o; \
 } while ( false )
 
+/* The tree walkers handle any depth; let the parser stack keep up */
+#define YYMAXDEPTH 10000000
+
 %}
 
 %left '|'
@@ -26,12 +38,16 @@
 %right '~'
 %expect 1
 
+%define api.pure full
+%parse-param {vslc_context_t *ctx} {void *scanner}
+%lex-param {void *scanner}
+
 %token FUNC PRINT RETURN CONTINUE IF THEN ELSE WHILE DO OPENBLOCK CLOSEBLOCK
 %token VAR NUMBER IDENTIFIER STRING
 
 %%
 program :
-      global_list { N1C ( root, PROGRAM, NULL, $1 ); }
+      global_list { N1C ( ctx->root, PROGRAM, NULL, $1 ); }
     ;
 global_list :
       global { N1C ( $$, GLOBAL_LIST, NULL, $1 ); }
@@ -115,35 +131,35 @@ while_statement :
     ;
 relation:
       expression '=' expression
-        { N2C ( $$, RELATION, strdup("="), $1, $3 ); }
+        { N2O ( $$, RELATION, OP_EQ, $1, $3 ); }
     | expression '<' expression
-        { N2C ( $$, RELATION, strdup("<"), $1, $3 ); }
+        { N2O ( $$, RELATION, OP_LT, $1, $3 ); }
     | expression '>' expression
-        { N2C ( $$, RELATION, strdup(">"), $1, $3 ); }
+        { N2O ( $$, RELATION, OP_GT, $1, $3 ); }
     ;
 expression :
       expression '|' expression
-        { N2C ( $$, EXPRESSION, strdup("|"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_OR, $1, $3 ); }
     | expression '^' expression
-        { N2C ( $$, EXPRESSION, strdup("^"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_XOR, $1, $3 ); }
     | expression '&' expression
-        { N2C ( $$, EXPRESSION, strdup("&"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_AND, $1, $3 ); }
     | expression RSHIFT expression
-        { N2C ( $$, EXPRESSION, strdup(">>"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_RSHIFT, $1, $3 ); }
     | expression LSHIFT expression
-        { N2C ( $$, EXPRESSION, strdup("<<"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_LSHIFT, $1, $3 ); }
     |  expression '+' expression
-        { N2C ( $$, EXPRESSION, strdup("+"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_ADD, $1, $3 ); }
     | expression '-' expression
-        { N2C ( $$, EXPRESSION, strdup("-"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_SUB, $1, $3 ); }
     | expression '*' expression
-        { N2C ( $$, EXPRESSION, strdup("*"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_MUL, $1, $3 ); }
     | expression '/' expression
-        { N2C ( $$, EXPRESSION, strdup("/"), $1, $3 ); }
+        { N2O ( $$, EXPRESSION, OP_DIV, $1, $3 ); }
     | '-' expression %prec UMINUS
-        { N1C ( $$, EXPRESSION, strdup("-"), $2 ); }
+        { N1O ( $$, EXPRESSION, OP_NEG, $2 ); }
     | '~' expression %prec UMINUS
-        { N1C ( $$, EXPRESSION, strdup("~"), $2 ); }
+        { N1O ( $$, EXPRESSION, OP_NOT, $2 ); }
     | '(' expression ')' { $$ = $2; }
     | number { N1C ( $$, EXPRESSION, NULL, $1 ); }
     | identifier
@@ -160,19 +176,30 @@ print_item :
     | string
         { N1C ( $$, PRINT_ITEM, NULL, $1 ); }
     ;
-identifier: IDENTIFIER { N0C($$, IDENTIFIER_DATA, strdup(yytext) ); }
+identifier: IDENTIFIER
+      {
+        N0C($$, IDENTIFIER_DATA, intern(&ctx->identifiers, yyget_text(scanner)) );
+      }
 number: NUMBER
       {
-        int64_t *value = malloc ( sizeof(int64_t) );
-        *value = strtol ( yytext, NULL, 10 );
+        int64_t *value = arena_alloc ( &ctx->tree_arena, sizeof(int64_t) );
+        *value = strtol ( yyget_text(scanner), NULL, 10 );
         N0C($$, NUMBER_DATA, value );
       }
-string: STRING { N0C($$, STRING_DATA, strdup(yytext) ); }
+string: STRING
+      {
+        N0C($$, STRING_DATA, arena_strdup(&ctx->tree_arena, yyget_text(scanner)) );
+      }
 %%
 
+/* Reports the error; yyparse then returns nonzero, and the caller
+ * decides what becomes of the compilation.
+ */
 int
-yyerror ( const char *error )
+yyerror ( vslc_context_t *ctx, void *scanner, const char *error )
 {
-    fprintf ( stderr, "%s on line %d\n", error, yylineno );
-    exit ( EXIT_FAILURE );
+    if ( ctx->filename != NULL )
+        fprintf ( stderr, "%s: ", ctx->filename );
+    fprintf ( stderr, "%s on line %d\n", error, yyget_lineno ( scanner ) );
+    return 0;
 }
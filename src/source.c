@@ -0,0 +1,62 @@
+/* MAP_ANONYMOUS is not part of POSIX.1-2008 */
+#define _DEFAULT_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <source.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+/* Maps the regular file open on fd, privately and writable: the scanner
+ * plants NUL bytes behind each token while it works. Only pages it
+ * writes to are copied; the rest are served from the page cache.
+ * The padding comes from the zero fill after the end of the file, or
+ * from an anonymous page when the file ends too close to a page
+ * boundary.
+ * Returns
+ *  SUCCESS - map describes the text
+ *  ESTREAM - fd is a pipe, terminal, empty file, ...; nothing is mapped
+ *  EMAP - mmap failed
+ */
+int
+source_map ( source_map_t *map, int fd )
+{
+    struct stat st;
+    *map = (source_map_t) { .base = NULL, .length = 0, .mapped = 0 };
+    if ( fstat ( fd, &st ) != 0 || ! S_ISREG ( st.st_mode ) || st.st_size == 0 )
+        return SOURCE_ESTREAM;
+
+    size_t page = (size_t) sysconf ( _SC_PAGESIZE );
+    size_t length = (size_t) st.st_size;
+    size_t mapped = (length + SOURCE_PADDING + page - 1) / page * page;
+
+    /* Reserve the whole range with zero pages, then lay the file over it */
+    char *base = mmap (
+        NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if ( base == MAP_FAILED )
+        return SOURCE_EMAP;
+    if ( mmap ( base, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fd, 0 ) == MAP_FAILED )
+    {
+        munmap ( base, mapped );
+        return SOURCE_EMAP;
+    }
+    posix_madvise ( base, length, POSIX_MADV_SEQUENTIAL );
+
+    *map = (source_map_t) { .base = base, .length = length, .mapped = mapped };
+    return SOURCE_SUCCESS;
+}
+
+
+void
+source_unmap ( source_map_t *map )
+{
+    if ( map->base != NULL )
+        munmap ( map->base, map->mapped );
+    *map = (source_map_t) { .base = NULL, .length = 0, .mapped = 0 };
+}
@@ -0,0 +1,268 @@
+#include <time.h>
+#include <sys/resource.h>
+
+#include <vslc.h>
+#include <stats.h>
+
+static const char *phase_names[STATS_N_PHASES] = {
+    "parse", "simplify", "symbols", "optimize", "print", "teardown"
+};
+
+static stats_cost_t now ( vslc_stats_t *stats, vslc_context_t *ctx );
+static int count_node ( node_t **slot, uint64_t depth, void *context );
+static void line ( writer_t *out, const char *format, ... );
+static void table_line ( writer_t *out, const char *label, tlhash_stats_t *stats );
+static void average ( tlhash_stats_t *sum );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+stats_init ( vslc_stats_t *stats, bool all_threads )
+{
+    *stats = (vslc_stats_t) { .all_threads = all_threads };
+}
+
+
+/* Marks the start of a phase; ctx is NULL once it is finalized */
+void
+stats_start ( vslc_stats_t *stats, vslc_context_t *ctx )
+{
+    stats->start = now ( stats, ctx );
+}
+
+
+void
+stats_stop ( vslc_stats_t *stats, vslc_context_t *ctx, stats_phase_t phase )
+{
+    stats_cost_t end = now ( stats, ctx );
+    stats_cost_t *cost = &stats->phases[phase];
+    cost->wall += end.wall - stats->start.wall;
+    cost->cpu += end.cpu - stats->start.cpu;
+    if ( ctx != NULL )
+    {
+        cost->n_allocs += end.n_allocs - stats->start.n_allocs;
+        cost->n_bytes += end.n_bytes - stats->start.n_bytes;
+    }
+    struct rusage usage;
+    if ( getrusage ( RUSAGE_SELF, &usage ) == 0 && usage.ru_maxrss > stats->peak_kb )
+        stats->peak_kb = usage.ru_maxrss;
+}
+
+
+uint64_t
+stats_count_nodes ( node_t *root )
+{
+    uint64_t n_nodes = 0;
+    tree_walk ( &root, count_node, NULL, &n_nodes );
+    return n_nodes;
+}
+
+
+/* Writes the report in one go, so that reports of compilations running
+ * side by side do not interleave
+ */
+void
+stats_report ( vslc_stats_t *stats, const char *name, int fd )
+{
+    writer_t out;
+    if ( writer_init ( &out, fd, 4096 ) != WRITER_SUCCESS )
+        return;
+    stats_cost_t total = { .wall = 0.0 };
+    line ( &out, "Statistics for %s:\n", ( name != NULL ) ? name : "<stdin>" );
+    line (
+        &out, "  %-10s %10s %10s %12s %12s\n", "phase", "wall ms", "cpu ms",
+        "arena allocs", "arena bytes"
+    );
+    for ( int p=0; p<STATS_N_PHASES; p++ )
+    {
+        stats_cost_t *cost = &stats->phases[p];
+        line (
+            &out, "  %-10s %10.3f %10.3f %12llu %12llu\n", phase_names[p],
+            cost->wall * 1e3, cost->cpu * 1e3,
+            (unsigned long long) cost->n_allocs, (unsigned long long) cost->n_bytes
+        );
+        total.wall += cost->wall;
+        total.cpu += cost->cpu;
+        total.n_allocs += cost->n_allocs;
+        total.n_bytes += cost->n_bytes;
+    }
+    line (
+        &out, "  %-10s %10.3f %10.3f %12llu %12llu\n", "total",
+        total.wall * 1e3, total.cpu * 1e3,
+        (unsigned long long) total.n_allocs, (unsigned long long) total.n_bytes
+    );
+    line (
+        &out, "  nodes: %llu parsed, %llu after simplification\n",
+        (unsigned long long) stats->nodes_parsed,
+        (unsigned long long) stats->nodes_simplified
+    );
+    line (
+        &out, "  symbol tables: %llu lookups, %llu inserts\n",
+        (unsigned long long) stats->n_lookups, (unsigned long long) stats->n_inserts
+    );
+    line ( &out, "  peak resident size: %ld KiB\n", stats->peak_kb );
+    writer_finalize ( &out );
+}
+
+
+/* How full the symbol tables are, how long their probe sequences run
+ * and, once tlhash_set_counting is on, how they were used: the globals,
+ * every function's locals, all locals tables together, and the scope
+ * tables binding resolved names with, if the context kept them
+ */
+void
+stats_report_tables ( vslc_context_t *ctx, int fd )
+{
+    writer_t out;
+    if ( ctx->global_names == NULL || writer_init ( &out, fd, WRITER_BUFFER_SIZE ) != WRITER_SUCCESS )
+        return;
+    line (
+        &out, "Symbol tables for %s:\n", ( ctx->filename != NULL ) ? ctx->filename : "<stdin>"
+    );
+    line (
+        &out, "  %-24s %8s %8s %5s %5s %4s  %-40s %9s %9s %6s\n", "table", "size", "slots",
+        "load", "probe", "max", "probe lengths 1..8+", "lookups", "misses", "bytes"
+    );
+    tlhash_stats_t stats, locals = { .size = 0 };
+    tlhash_stats ( ctx->global_names, &stats );
+    table_line ( &out, "globals", &stats );
+
+    size_t n_globals = tlhash_size ( ctx->global_names );
+    symbol_t **globals = malloc ( (n_globals + 1) * sizeof(symbol_t *) );
+    if ( globals != NULL )
+    {
+        char label[64];
+        tlhash_values ( ctx->global_names, (void **)globals );
+        for ( size_t g=0; g<n_globals; g++ )
+        {
+            if ( globals[g]->locals == NULL )
+                continue;
+            tlhash_stats ( globals[g]->locals, &stats );
+            snprintf ( label, sizeof(label), "locals of %s", globals[g]->name->text );
+            table_line ( &out, label, &stats );
+            stats_add_table ( &locals, &stats );
+        }
+        free ( globals );
+    }
+    if ( locals.size > 0 )
+    {
+        average ( &locals );
+        table_line ( &out, "all locals", &locals );
+    }
+    if ( ctx->scope_tables != NULL && ctx->scope_tables->n_slots > 0 )
+    {
+        stats = *ctx->scope_tables;
+        average ( &stats );
+        table_line ( &out, "all scope tables", &stats );
+    }
+    writer_finalize ( &out );
+}
+
+
+/* Sums the counts; means are left for average to divide */
+void
+stats_add_table ( tlhash_stats_t *sum, tlhash_stats_t *stats )
+{
+    sum->size += stats->size;
+    sum->n_slots += stats->n_slots;
+    for ( int b=0; b<TLHASH_PROBE_BUCKETS; b++ )
+        sum->probe_lengths[b] += stats->probe_lengths[b];
+    if ( stats->max_probe_length > sum->max_probe_length )
+        sum->max_probe_length = stats->max_probe_length;
+    sum->mean_probe_length += stats->mean_probe_length * stats->size;
+    sum->counted = stats->counted;
+    sum->n_lookups += stats->n_lookups;
+    sum->n_hits += stats->n_hits;
+    sum->n_misses += stats->n_misses;
+    sum->mean_bytes_hashed += stats->mean_bytes_hashed * stats->n_lookups;
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static stats_cost_t
+now ( vslc_stats_t *stats, vslc_context_t *ctx )
+{
+    struct timespec wall, cpu;
+    clock_gettime ( CLOCK_MONOTONIC, &wall );
+    clock_gettime (
+        stats->all_threads ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID, &cpu
+    );
+    stats_cost_t cost = {
+        .wall = wall.tv_sec + wall.tv_nsec * 1e-9,
+        .cpu = cpu.tv_sec + cpu.tv_nsec * 1e-9,
+        .n_allocs = 0,
+        .n_bytes = 0
+    };
+    if ( ctx != NULL )
+    {
+        cost.n_allocs = ctx->tree_arena.n_allocs + ctx->identifiers.storage.n_allocs;
+        cost.n_bytes = ctx->tree_arena.n_bytes + ctx->identifiers.storage.n_bytes;
+    }
+    return cost;
+}
+
+
+static int
+count_node ( node_t **slot, uint64_t depth, void *context )
+{
+    if ( *slot != NULL )
+        *((uint64_t *) context) += 1;
+    return WALK_CONTINUE;
+}
+
+
+static void
+table_line ( writer_t *out, const char *label, tlhash_stats_t *stats )
+{
+    char histogram[64];
+    int at = 0;
+    for ( int b=0; b<TLHASH_PROBE_BUCKETS; b++ )
+        at += snprintf (
+            histogram + at, sizeof(histogram) - at, "%s%zu",
+            ( b > 0 ) ? " " : "", stats->probe_lengths[b]
+        );
+    line (
+        out, "  %-24.24s %8zu %8zu %5.2f %5.2f %4zu  %-40s", label, stats->size,
+        stats->n_slots, stats->load_factor, stats->mean_probe_length,
+        stats->max_probe_length, histogram
+    );
+    if ( stats->counted )
+        line (
+            out, " %9llu %9llu %6.1f\n", (unsigned long long) stats->n_lookups,
+            (unsigned long long) stats->n_misses, stats->mean_bytes_hashed
+        );
+    else
+        line ( out, " %9s %9s %6s\n", "-", "-", "-" );
+}
+
+
+/* Turns the sums of stats_add_table into means */
+static void
+average ( tlhash_stats_t *sum )
+{
+    sum->load_factor = (double) sum->size / sum->n_slots;
+    if ( sum->size > 0 )
+        sum->mean_probe_length /= sum->size;
+    if ( sum->n_lookups > 0 )
+        sum->mean_bytes_hashed /= sum->n_lookups;
+}
+
+
+static void
+line ( writer_t *out, const char *format, ... )
+{
+    char text[256];
+    va_list args;
+    va_start ( args, format );
+    vsnprintf ( text, sizeof(text), format, args );
+    va_end ( args );
+    writer_string ( out, text );
+}
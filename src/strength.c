@@ -0,0 +1,262 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Strength reduction. A multiplication by a constant becomes a shift,
+ * or a shift and an add or subtract where the constant is one off a
+ * power of two. A division by a power of two becomes shifts that round
+ * towards zero, as division does. Operations with an identity or an
+ * absorbing constant, or with the same variable on both sides, are
+ * simplified away. An operand that calls something or may trap is
+ * never dropped. Each operator is given a rough cost, and a rewrite is
+ * only made when what replaces an operator costs less than the operator
+ * itself. Division by other constants is left alone: the tree has no
+ * operator for the high half of a product, which a reciprocal would
+ * need.
+ */
+
+typedef struct {
+    arena_t *arena;
+    int cost;                   /* Of the operators made for a rewrite */
+} reducer_t;
+
+static int reduce ( node_t **slot, uint64_t depth, void *context );
+static node_t *reduce_binary ( reducer_t *reducer, node_t *node );
+static node_t *multiply ( reducer_t *reducer, node_t *x, int64_t c );
+static node_t *divide ( reducer_t *reducer, node_t *x, int64_t c );
+static node_t *cheaper ( reducer_t *reducer, node_t *rewrite, int cost );
+static node_t *operation ( reducer_t *reducer, operator_t op, node_t *left, node_t *right );
+static node_t *number ( reducer_t *reducer, int64_t value );
+static node_t *duplicate ( reducer_t *reducer, node_t *node );
+static bool is_number ( node_t *node );
+static int exact_log2 ( uint64_t u );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+reduce_strength ( vslc_context_t *ctx, symbol_t *function )
+{
+    reducer_t reducer = { .arena = &ctx->tree_arena, .cost = 0 };
+    tree_walk ( &function->node->children[2], NULL, reduce, &reducer );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Operands are reduced before the operations on them */
+static int
+reduce ( node_t **slot, uint64_t depth, void *context )
+{
+    reducer_t *reducer = context;
+    node_t *node = *slot;
+    if ( node->type != EXPRESSION || node->op == OP_NONE )
+        return WALK_CONTINUE;
+    if ( node->n_children == 1 )
+    {
+        /* - - x and ~ ~ x */
+        node_t *operand = node->children[0];
+        if ( operand->type == EXPRESSION && operand->op == node->op && operand->n_children == 1 )
+            *slot = operand->children[0];
+        return WALK_CONTINUE;
+    }
+    if ( is_number ( node->children[0] ) && is_number ( node->children[1] ) )
+    {
+        /* Left by reductions below, such as x * 0 */
+        fold_tree ( slot );
+        return WALK_CONTINUE;
+    }
+    reducer->cost = 0;
+    node_t *reduced = reduce_binary ( reducer, node );
+    if ( reduced != NULL )
+        *slot = reduced;
+    return WALK_CONTINUE;
+}
+
+
+/* Returns what the operation reduces to, or NULL if it stays */
+static node_t *
+reduce_binary ( reducer_t *reducer, node_t *node )
+{
+    node_t *x = node->children[0], *y = node->children[1];
+    operator_t op = node->op;
+
+    /* Constants of operations that commute are taken on the right */
+    if ( is_number ( x ) &&
+         (op == OP_ADD || op == OP_MUL || op == OP_AND || op == OP_OR || op == OP_XOR) )
+    {
+        x = node->children[1];
+        y = node->children[0];
+    }
+    if ( !is_number ( y ) )
+    {
+        if ( x->type != IDENTIFIER_DATA || y->type != IDENTIFIER_DATA ||
+             x->entry == NULL || x->entry != y->entry )
+            return NULL;
+        switch ( op )
+        {
+            case OP_SUB: case OP_XOR: return number ( reducer, 0 );
+            case OP_AND: case OP_OR: return x;
+            default: return NULL;
+        }
+    }
+
+    int64_t c = *((int64_t *) y->data);
+    bool pure = is_pure ( x );
+    switch ( op )
+    {
+        case OP_ADD: case OP_SUB: case OP_XOR:
+            return ( c == 0 ) ? x : NULL;
+        case OP_OR:
+            if ( c == 0 )
+                return x;
+            return ( c == -1 && pure ) ? y : NULL;
+        case OP_AND:
+            if ( c == -1 )
+                return x;
+            return ( c == 0 && pure ) ? y : NULL;
+        case OP_LSHIFT: case OP_RSHIFT:
+            /* Shift counts are taken modulo 64 */
+            return ( (c & 63) == 0 ) ? x : NULL;
+        case OP_MUL:
+            if ( c == 1 )
+                return x;
+            if ( c == 0 && pure )
+                return y;
+            return cheaper ( reducer, multiply ( reducer, x, c ), COST_MUL );
+        case OP_DIV:
+            if ( c == 1 )
+                return x;
+            return cheaper ( reducer, divide ( reducer, x, c ), COST_DIV );
+        default:
+            return NULL;
+    }
+}
+
+
+/* x * c as shifts, and an add or subtract if c is one off a power of
+ * two; those use x twice, so x has to be cheap to evaluate again
+ */
+static node_t *
+multiply ( reducer_t *reducer, node_t *x, int64_t c )
+{
+    uint64_t u = (uint64_t) c;
+    int k;
+    if ( (k = exact_log2 ( u )) >= 0 )
+        return operation ( reducer, OP_LSHIFT, x, number ( reducer, k ) );
+    if ( (k = exact_log2 ( 0 - u )) == 0 )
+        return operation ( reducer, OP_NEG, x, NULL );
+    if ( k > 0 )
+        return operation (
+            reducer, OP_NEG, operation ( reducer, OP_LSHIFT, x, number ( reducer, k ) ), NULL
+        );
+    if ( !is_trivial ( x ) )
+        return NULL;
+    node_t *again = duplicate ( reducer, x );
+    if ( (k = exact_log2 ( u - 1 )) > 0 )
+        return operation (
+            reducer, OP_ADD, operation ( reducer, OP_LSHIFT, x, number ( reducer, k ) ), again
+        );
+    if ( (k = exact_log2 ( u + 1 )) > 0 )
+        return operation (
+            reducer, OP_SUB, operation ( reducer, OP_LSHIFT, x, number ( reducer, k ) ), again
+        );
+    if ( (k = exact_log2 ( 1 - u )) > 0 )
+        return operation (
+            reducer, OP_SUB, again, operation ( reducer, OP_LSHIFT, x, number ( reducer, k ) )
+        );
+    return NULL;
+}
+
+
+/* x / 2^k is (x + bias) >> k, where the bias of 2^k - 1 for negative x
+ * makes the shift round towards zero: (x >> 63) & (2^k - 1). A negative
+ * divisor negates the quotient. The sign of x is taken apart from x,
+ * so x has to be cheap to evaluate again.
+ */
+static node_t *
+divide ( reducer_t *reducer, node_t *x, int64_t c )
+{
+    uint64_t magnitude = ( c < 0 ) ? 0 - (uint64_t) c : (uint64_t) c;
+    int k = exact_log2 ( magnitude );
+    if ( k < 1 || k > 62 || !is_trivial ( x ) )
+        return NULL;
+    node_t *sign = operation ( reducer, OP_RSHIFT, x, number ( reducer, 63 ) );
+    node_t *bias = operation (
+        reducer, OP_AND, sign, number ( reducer, ((int64_t) 1 << k) - 1 )
+    );
+    node_t *quotient = operation (
+        reducer, OP_RSHIFT,
+        operation ( reducer, OP_ADD, duplicate ( reducer, x ), bias ),
+        number ( reducer, k )
+    );
+    return ( c < 0 ) ? operation ( reducer, OP_NEG, quotient, NULL ) : quotient;
+}
+
+
+/* The rewrite, if its operators cost less than the one it replaces */
+static node_t *
+cheaper ( reducer_t *reducer, node_t *rewrite, int cost )
+{
+    return ( rewrite != NULL && reducer->cost < cost ) ? rewrite : NULL;
+}
+
+
+/* A binary operation, or a unary one if right is NULL */
+static node_t *
+operation ( reducer_t *reducer, operator_t op, node_t *left, node_t *right )
+{
+    node_t *node = arena_alloc ( reducer->arena, sizeof(node_t) );
+    if ( right != NULL )
+        node_init ( node, reducer->arena, EXPRESSION, NULL, 2, left, right );
+    else
+        node_init ( node, reducer->arena, EXPRESSION, NULL, 1, left );
+    node->op = op;
+    reducer->cost += ( op == OP_MUL ) ? COST_MUL : ( op == OP_DIV ) ? COST_DIV : COST_SIMPLE;
+    return node;
+}
+
+
+static node_t *
+number ( reducer_t *reducer, int64_t value )
+{
+    int64_t *data = arena_alloc ( reducer->arena, sizeof(int64_t) );
+    *data = value;
+    node_t *node = arena_alloc ( reducer->arena, sizeof(node_t) );
+    node_init ( node, reducer->arena, NUMBER_DATA, data, 0 );
+    return node;
+}
+
+
+/* Another use of a variable or constant */
+static node_t *
+duplicate ( reducer_t *reducer, node_t *node )
+{
+    if ( node->type == NUMBER_DATA )
+        return number ( reducer, *((int64_t *) node->data) );
+    node_t *copy = arena_alloc ( reducer->arena, sizeof(node_t) );
+    *copy = *node;
+    return copy;
+}
+
+
+static bool
+is_number ( node_t *node )
+{
+    return node->type == NUMBER_DATA;
+}
+
+
+/* k if u is 2^k, -1 if it is not a power of two */
+static int
+exact_log2 ( uint64_t u )
+{
+    if ( u == 0 || (u & (u - 1)) != 0 )
+        return -1;
+    return __builtin_ctzll ( u );
+}
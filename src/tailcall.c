@@ -0,0 +1,367 @@
+#include <vslc.h>
+#include <optimize.h>
+
+/* Self-recursive tail call elimination: when every path through a
+ * function ends in a return, and some of them return a call of the
+ * function itself, the body becomes the body of a while loop. Each of
+ * those returns assigns the call's arguments to the parameters instead,
+ * and control goes round the loop again. An argument that is evaluated
+ * after a parameter it refers to has been assigned reads a temporary
+ * instead. Temporaries are declared in a block of their own around the
+ * loop, and added to the function's locals table.
+ */
+
+typedef struct {
+    node_t ***slots;
+    size_t n_slots, max_slots;
+} slots_t;
+
+typedef struct {
+    arena_t *arena;
+    symbol_t *function;
+    symbol_t **parameters;      /* By position */
+    symbol_t **temporaries;     /* By parameter position, if needed */
+    bool *needed;               /* Whether some call needs the temporary */
+    slots_t sites;              /* Returns of tail calls */
+} tail_t;
+
+static int find_self_call ( node_t **slot, uint64_t depth, void *context );
+static int find_symbol ( node_t **slot, uint64_t depth, void *context );
+static bool is_self_call ( node_t *expression, symbol_t *function );
+static bool collect_sites ( tail_t *tail, node_t **body );
+static bool lift ( tail_t *tail, node_t *list, uint64_t s );
+static bool needs_temporary ( tail_t *tail, node_t *arguments, uint64_t a );
+static bool find_parameters ( tail_t *tail );
+static bool make_temporaries ( tail_t *tail, vslc_context_t *ctx );
+static node_t *assign_arguments ( tail_t *tail, node_t *call );
+static node_t *make_loop ( tail_t *tail, node_t *body );
+static bool push_slot ( slots_t *slots, node_t **slot );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+void
+eliminate_tail_calls ( vslc_context_t *ctx, symbol_t *function )
+{
+    node_t **body = &function->node->children[2];
+    if ( !always_returns ( *body ) ||
+         tree_walk ( body, find_self_call, NULL, function ) != WALK_ABORT )
+        return;
+
+    size_t n_parameters = function->nparms;
+    tail_t tail = {
+        .arena = &ctx->tree_arena,
+        .function = function,
+        .parameters = calloc ( n_parameters + 1, sizeof(symbol_t *) ),
+        .temporaries = calloc ( n_parameters + 1, sizeof(symbol_t *) ),
+        .needed = calloc ( n_parameters + 1, sizeof(bool) ),
+        .sites = { .slots = NULL }
+    };
+    if ( tail.parameters == NULL || tail.temporaries == NULL || tail.needed == NULL ||
+         !find_parameters ( &tail ) || !collect_sites ( &tail, body ) ||
+         tail.sites.n_slots == 0 )
+        goto done;
+
+    /* Temporaries are made before the tree changes, as they may fail */
+    for ( size_t s=0; s<tail.sites.n_slots; s++ )
+    {
+        node_t *arguments = (*tail.sites.slots[s])->children[0]->children[1];
+        for ( size_t p=0; p<n_parameters; p++ )
+            if ( needs_temporary ( &tail, arguments, p ) )
+                tail.needed[p] = true;
+    }
+    if ( !make_temporaries ( &tail, ctx ) )
+        goto done;
+
+    for ( size_t s=0; s<tail.sites.n_slots; s++ )
+    {
+        node_t **site = tail.sites.slots[s];
+        *site = assign_arguments ( &tail, (*site)->children[0] );
+    }
+    *body = make_loop ( &tail, *body );
+
+done:
+    free ( tail.parameters );
+    free ( tail.temporaries );
+    free ( tail.needed );
+    free ( tail.sites.slots );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static int
+find_self_call ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *node = *slot;
+    if ( node != NULL && node->type == RETURN_STATEMENT &&
+         is_self_call ( node->children[0], context ) )
+        return WALK_ABORT;
+    return WALK_CONTINUE;
+}
+
+
+static int
+find_symbol ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *node = *slot;
+    if ( node != NULL && node->entry == context )
+        return WALK_ABORT;
+    return WALK_CONTINUE;
+}
+
+
+/* A call of the function with as many arguments as it has parameters */
+static bool
+is_self_call ( node_t *expression, symbol_t *function )
+{
+    if ( expression->type != EXPRESSION || expression->op != OP_NONE ||
+         expression->n_children != 2 )
+        return false;
+    node_t *arguments = expression->children[1];
+    uint64_t n_arguments = ( arguments != NULL ) ? arguments->n_children : 0;
+    return expression->children[0]->entry == function && n_arguments == function->nparms;
+}
+
+
+/* Follows the body down to the statements that end it, the last ones
+ * of blocks and both branches of ifs, and gathers the returns of self
+ * calls among them
+ */
+static bool
+collect_sites ( tail_t *tail, node_t **body )
+{
+    slots_t pending = { .slots = NULL };
+    bool ok = push_slot ( &pending, body );
+    while ( ok && pending.n_slots > 0 )
+    {
+        node_t **slot = pending.slots[--pending.n_slots];
+        node_t *node = *slot;
+        switch ( node->type )
+        {
+            case BLOCK:
+            {
+                node_t *list = node->children[node->n_children - 1];
+                for ( uint64_t s=0; s+1<list->n_children; s++ )
+                    if ( lift ( tail, list, s ) )
+                        break;
+                if ( list->n_children > 0 )
+                    ok = push_slot ( &pending, &list->children[list->n_children - 1] );
+                break;
+            }
+            case IF_STATEMENT:
+                ok = push_slot ( &pending, &node->children[1] );
+                if ( ok && node->n_children > 2 )
+                    ok = push_slot ( &pending, &node->children[2] );
+                break;
+            case RETURN_STATEMENT:
+                if ( is_self_call ( node->children[0], tail->function ) )
+                    ok = push_slot ( &tail->sites, slot );
+                break;
+            default:
+                break;
+        }
+    }
+    free ( pending.slots );
+    return ok;
+}
+
+
+/* A tail call has to be the last thing done on its path. When one
+ * branch of an if always returns and holds a self call, the statements
+ * after the if are moved into the other branch, which makes the if the
+ * last statement of its list.
+ * Returns whether the list was cut short after statement s.
+ */
+static bool
+lift ( tail_t *tail, node_t *list, uint64_t s )
+{
+    node_t *statement = list->children[s];
+    if ( statement->type != IF_STATEMENT )
+        return false;
+    node_t **branches = statement->children;
+    int returning = -1;
+    for ( int b=1; b<3; b++ )
+        if ( b < statement->n_children && always_returns ( branches[b] ) &&
+             tree_walk ( &branches[b], find_self_call, NULL, tail->function ) == WALK_ABORT )
+            returning = b;
+    if ( returning < 0 )
+        return false;
+    int other = 3 - returning;
+    if ( other < statement->n_children && always_returns ( branches[other] ) )
+        return false;
+
+    uint64_t n_rest = list->n_children - (s + 1);
+    node_t *rest = make_list ( tail->arena, STATEMENT_LIST, n_rest + 1 );
+    if ( other < statement->n_children )
+        rest->children[rest->n_children++] = branches[other];
+    for ( uint64_t r=s+1; r<list->n_children; r++ )
+        rest->children[rest->n_children++] = list->children[r];
+    node_t *block = arena_alloc ( tail->arena, sizeof(node_t) );
+    node_init ( block, tail->arena, BLOCK, NULL, 1, rest );
+
+    if ( other >= statement->n_children )
+    {
+        node_t **grown = arena_alloc ( tail->arena, 3 * sizeof(node_t *) );
+        grown[0] = branches[0];
+        grown[1] = branches[1];
+        statement->children = grown;
+        statement->n_children = 3;
+    }
+    statement->children[other] = block;
+    list->n_children = s + 1;
+    return true;
+}
+
+
+/* Whether an argument after the a-th refers to the a-th parameter, so
+ * that the parameter may not be assigned until they are evaluated
+ */
+static bool
+needs_temporary ( tail_t *tail, node_t *arguments, uint64_t a )
+{
+    for ( uint64_t later=a+1; later<tail->function->nparms; later++ )
+        if ( tree_walk ( &arguments->children[later], find_symbol, NULL,
+                         tail->parameters[a] ) == WALK_ABORT )
+            return true;
+    return false;
+}
+
+
+static bool
+find_parameters ( tail_t *tail )
+{
+    tlhash_t *locals = tail->function->locals;
+    size_t n_locals = tlhash_size ( locals );
+    symbol_t **symbols = malloc ( (n_locals + 1) * sizeof(symbol_t *) );
+    if ( symbols == NULL )
+        return false;
+    tlhash_values ( locals, (void **)symbols );
+    for ( size_t l=0; l<n_locals; l++ )
+        if ( symbols[l]->type == SYM_PARAMETER && symbols[l]->seq < tail->function->nparms )
+            tail->parameters[symbols[l]->seq] = symbols[l];
+    free ( symbols );
+
+    /* A parameter that could not be declared has no symbol */
+    for ( size_t p=0; p<tail->function->nparms; p++ )
+        if ( tail->parameters[p] == NULL )
+            return false;
+    return true;
+}
+
+
+/* Temporaries are named after their parameters with a prime, which no
+ * VSL identifier has
+ */
+static bool
+make_temporaries ( tail_t *tail, vslc_context_t *ctx )
+{
+    uint64_t scope;
+    size_t seq;
+    if ( !local_extent ( tail->function, &scope, &seq ) )
+        return false;
+    scope += 1;
+    for ( size_t p=0; p<tail->function->nparms; p++ )
+    {
+        if ( !tail->needed[p] )
+            continue;
+        ident_t *parameter = tail->parameters[p]->name;
+        char name[parameter->length + 2];
+        snprintf ( name, sizeof(name), "%s'", parameter->text );
+        tail->temporaries[p] = add_local ( ctx, tail->function, name, scope, seq++ );
+        if ( tail->temporaries[p] == NULL )
+            return false;
+    }
+    return true;
+}
+
+
+/* The assignments that stand in for a tail call: parameters whose old
+ * value a later argument needs go through their temporaries, the rest
+ * are assigned as their arguments are evaluated, and arguments that
+ * pass a parameter on unchanged are left out
+ */
+static node_t *
+assign_arguments ( tail_t *tail, node_t *call )
+{
+    node_t *arguments = call->children[1];
+    uint64_t n_parameters = tail->function->nparms;
+    node_t *assignments = make_list ( tail->arena, STATEMENT_LIST, 2 * n_parameters + 1 );
+    for ( int pass=0; pass<2; pass++ )
+        for ( uint64_t p=0; p<n_parameters; p++ )
+        {
+            node_t *argument = arguments->children[p];
+            symbol_t *parameter = tail->parameters[p];
+            if ( argument->type == IDENTIFIER_DATA && argument->entry == parameter )
+                continue;
+            bool deferred = needs_temporary ( tail, arguments, p );
+            node_t *target, *value;
+            if ( pass == 0 )
+            {
+                target = make_reference ( tail->arena, deferred ? tail->temporaries[p] : parameter );
+                value = argument;
+            }
+            else if ( deferred )
+            {
+                target = make_reference ( tail->arena, parameter );
+                value = make_reference ( tail->arena, tail->temporaries[p] );
+            }
+            else
+                continue;
+            node_t *assignment = arena_alloc ( tail->arena, sizeof(node_t) );
+            node_init ( assignment, tail->arena, ASSIGNMENT_STATEMENT, NULL, 2, target, value );
+            assignments->children[assignments->n_children++] = assignment;
+        }
+
+    node_t *block = arena_alloc ( tail->arena, sizeof(node_t) );
+    node_init ( block, tail->arena, BLOCK, NULL, 1, assignments );
+    return block;
+}
+
+
+/* begin var n', ... while 1 do body end, the condition being what a
+ * folded relation that always holds leaves behind
+ */
+static node_t *
+make_loop ( tail_t *tail, node_t *body )
+{
+    arena_t *arena = tail->arena;
+    int64_t *one = arena_alloc ( arena, sizeof(int64_t) );
+    *one = 1;
+    node_t *condition = arena_alloc ( arena, sizeof(node_t) );
+    node_init ( condition, arena, NUMBER_DATA, one, 0 );
+    node_t *loop = arena_alloc ( arena, sizeof(node_t) );
+    node_init ( loop, arena, WHILE_STATEMENT, NULL, 2, condition, body );
+    node_t *statements = arena_alloc ( arena, sizeof(node_t) );
+    node_init ( statements, arena, STATEMENT_LIST, NULL, 1, loop );
+
+    node_t *names = make_list ( arena, VARIABLE_LIST, tail->function->nparms + 1 );
+    for ( size_t p=0; p<tail->function->nparms; p++ )
+        if ( tail->temporaries[p] != NULL )
+            names->children[names->n_children++] = tail->temporaries[p]->node;
+
+    return make_declaring_block ( arena, names, statements );
+}
+
+
+static bool
+push_slot ( slots_t *slots, node_t **slot )
+{
+    if ( slots->n_slots == slots->max_slots )
+    {
+        size_t max_slots = ( slots->max_slots > 0 ) ? 2 * slots->max_slots : 16;
+        node_t ***grown = realloc ( slots->slots, max_slots * sizeof(node_t **) );
+        if ( grown == NULL )
+            return false;
+        slots->slots = grown;
+        slots->max_slots = max_slots;
+    }
+    slots->slots[slots->n_slots++] = slot;
+    return true;
+}
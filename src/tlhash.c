@@ -4,6 +4,11 @@
 
 #include <tlhash.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC
+#endif
+
 /*********************************************************************
  * Declarations of the utility functions for obtaining hashes, found *
  * at the bottom of this file.                                       *
@@ -14,7 +19,47 @@
 static const uint32_t crc32_ieee802_3[256];
 static const uint32_t *crc_table = (uint32_t *)crc32_ieee802_3;
 
-static uint32_t crc32 ( void *input, size_t length );
+static uint32_t crc32 ( const void *input, size_t length );
+static uint32_t crc32c ( const void *input, size_t length );
+static uint32_t mum_hash ( const void *input, size_t length );
+static uint32_t resolve_hash ( const void *input, size_t length );
+
+/* Hash backends, in order of preference. The backend is picked on the
+ * first hash computed, unless tlhash_set_hash chose one before that.
+ */
+static const struct {
+    const char *name;
+    uint32_t (*fn) ( const void *input, size_t length );
+} backends[] = {
+    { "crc32c", crc32c },
+    { "mum", mum_hash },
+    { "crc32", crc32 }
+};
+#define N_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static uint32_t (*hash_fn) ( const void *, size_t ) = resolve_hash;
+static int counting = 0;
+static const char *hash_name = NULL;
+static int backend_supported ( size_t b );
+
+
+/* The index doubles once it is more than 3/4 full, and entries are
+ * compacted once more than half of them have been removed.
+ */
+#define MAX_LOAD(n_slots) ((n_slots) - (n_slots) / 4)
+#define REMOVED UINT32_MAX
+
+#define COUNT(tab, counter, n) \
+    do { \
+        if ( counting ) \
+            __atomic_fetch_add ( &(tab)->counters.counter, (n), __ATOMIC_RELAXED ); \
+    } while ( 0 )
+
+static int rebuild ( tlhash_t *tab, size_t n_slots );
+static void place ( tlhash_t *tab, uint32_t hash, uint32_t entry );
+static size_t find_slot (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash
+);
 
 
 /********************************
@@ -22,23 +67,32 @@ static uint32_t crc32 ( void *input, size_t length );
  ********************************/
 
 
-/* Initializer 
+/* Initializer - n_buckets is only a sizing hint now, the table grows
+ * as needed.
  * Returns
  *  ENOMEM - if allocation of table entries fails.
  */
 int
 tlhash_init ( tlhash_t *tab, size_t n_buckets )
 {
-    size_t i;
-    tab->n_buckets = n_buckets;
+    size_t n_slots = 8;
+    while ( MAX_LOAD(n_slots) < n_buckets )
+        n_slots *= 2;
+    tab->n_slots = n_slots;
     tab->size = 0;
-    tab->buckets = (tlhash_element_t **) calloc (
-        n_buckets, sizeof(tlhash_element_t *)
+    tab->n_entries = 0;
+    tab->max_entries = MAX_LOAD(n_slots);
+    tab->counters = (tlhash_counters_t) { .n_lookups = 0 };
+    tab->slots = (tlhash_slot_t *) calloc ( n_slots, sizeof(tlhash_slot_t) );
+    tab->entries = (tlhash_entry_t *) malloc (
+        tab->max_entries * sizeof(tlhash_entry_t)
     );
-    if ( tab->buckets == NULL )
+    if ( tab->slots == NULL || tab->entries == NULL )
+    {
+        free ( tab->slots );
+        free ( tab->entries );
         return TLHASH_ENOMEM;
-    for ( i=0; i<n_buckets; i++ )
-        tab->buckets[i] = NULL;
+    }
     return TLHASH_SUCCESS;
 }
 
@@ -53,25 +107,20 @@ tlhash_finalize ( tlhash_t *tab )
     size_t i;
     if ( tab == NULL )
         return TLHASH_ENOENT;
-    for ( i=0; i<tab->n_buckets; i++ )
+    for ( i=0; i<tab->n_entries; i++ )
     {
-        tlhash_element_t *element = tab->buckets[i], *next;
-        while ( element != NULL )
-        {
-            next = element->next;
-            free ( element->key );
-            free ( element );
-            tab->size -= 1;
-            element = next;
-        }
+        tlhash_entry_t *e = &tab->entries[i];
+        if ( e->key_length != REMOVED && e->key_length > TLHASH_INLINE_KEY )
+            free ( e->key.ptr );
     }
-
-    free ( tab->buckets );
+    free ( tab->slots );
+    free ( tab->entries );
+    tab->size = tab->n_entries = 0;
     return TLHASH_SUCCESS;
 }
 
 
-/* Insert - find hash value, modulate over buckets, append to linked list
+/* Insert - find hash value, append an entry and index it
  * Returns
  *  EEXIST - if an element is already indexed by this key
  *  ENOMEM - if allocation of element or key copy fails
@@ -81,33 +130,13 @@ tlhash_insert (
     tlhash_t *tab, void *key, size_t key_length, void *value
 )
 {
-    void *test_entry;
-    int test = tlhash_lookup ( tab, key, key_length, &test_entry );
-    if ( test != TLHASH_ENOENT )
-        return TLHASH_EEXIST;
-    uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *element = malloc ( sizeof(tlhash_element_t) );
-    if ( element == NULL )
-        return TLHASH_ENOMEM;
-    void *key_copy = malloc ( key_length );
-    if ( key_copy == NULL )
-    {
-        free ( element );
-        return TLHASH_ENOMEM;
-    }
-    memcpy ( key_copy, key, key_length );
-    element->key         = key_copy;
-    element->key_length  = key_length;
-    element->value       = value;
-    element->next        = tab->buckets[bucket];
-    tab->buckets[bucket] = element;
-    tab->size += 1;
-    return TLHASH_SUCCESS;
+    return tlhash_insert_hashed (
+        tab, key, key_length, hash_fn ( key, key_length ), value
+    );
 }
 
 
-/* Lookup - find hash value, modulate over buckets, search linked list
+/* Lookup - find hash value, probe the index from its home slot
  * Returns
  *  ENOENT - if no element is indexed by this key
  */
@@ -116,62 +145,121 @@ tlhash_lookup (
     tlhash_t *tab, void *key, size_t key_length, void **value
 )
 {
-    uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *el = tab->buckets[bucket];
-
-    *value = NULL;
-    while ( el != NULL )
-    {
-        if ( el->key_length == key_length && ! memcmp(el->key,key,key_length) )
-        {
-            *value = el->value;
-            break;
-        }
-        el = el->next;
-    }
-    if ( el != NULL )
-        return TLHASH_SUCCESS;
-    else
-        return TLHASH_ENOENT;
+    return tlhash_lookup_hashed (
+        tab, key, key_length, hash_fn ( key, key_length ), value
+    );
 }
 
 
-/* Removal - find hash value, modulate over buckets, delete entry
+/* Removal - find hash value, probe the index, delete entry
  * Returns
  *  ENOENT - no such element to remove was found.
  */
 int
 tlhash_remove ( tlhash_t *tab, void *key, size_t key_length )
 {
-    uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *el = tab->buckets[bucket], *prev = NULL;
+    return tlhash_remove_hashed (
+        tab, key, key_length, hash_fn ( key, key_length )
+    );
+}
+
+
+/* The _hashed variants take a hash value computed by the caller, for
+ * keys that carry a precomputed hash of their own. A table must be used
+ * either only through these or only through the plain functions.
+ */
+int
+tlhash_insert_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash, void *value
+)
+{
+    if ( find_slot ( tab, key, key_length, hash ) != tab->n_slots )
+        return TLHASH_EEXIST;
 
-    while ( el != NULL )
+    /* Make room in the index and the entry array */
+    if ( tab->size + 1 > MAX_LOAD(tab->n_slots) )
     {
-        if ( el->key_length == key_length && ! memcmp(el->key,key,key_length) )
-        {
-            /* We have a match. */
-            if ( prev != NULL ) /* Remove from list if it's not the head */
-                prev->next = (void *)el->next;
-            else                /* Substitute it if it IS the head */
-                tab->buckets[bucket] = el->next;
-            /* Free the container and key copy allocated by this lib */
-            free ( el->key );
-            free ( el );
-            break;
-        }
-        prev = el;
-        el = el->next;
+        if ( rebuild ( tab, tab->n_slots * 2 ) )
+            return TLHASH_ENOMEM;
+    }
+    else if ( tab->n_entries == tab->max_entries )
+    {
+        if ( rebuild ( tab, tab->n_slots ) )
+            return TLHASH_ENOMEM;
+    }
+
+    tlhash_entry_t *e = &tab->entries[tab->n_entries];
+    if ( key_length > TLHASH_INLINE_KEY )
+    {
+        e->key.ptr = malloc ( key_length );
+        if ( e->key.ptr == NULL )
+            return TLHASH_ENOMEM;
+        memcpy ( e->key.ptr, key, key_length );
     }
-    if ( el == NULL )
-        return TLHASH_ENOENT;
     else
+        memcpy ( e->key.bytes, key, key_length );
+    e->hash = hash;
+    e->key_length = key_length;
+    e->value = value;
+    tab->n_entries += 1;
+    tab->size += 1;
+    place ( tab, hash, tab->n_entries );
+    return TLHASH_SUCCESS;
+}
+
+
+int
+tlhash_lookup_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash, void **value
+)
+{
+    size_t slot = find_slot ( tab, key, key_length, hash );
+    COUNT ( tab, n_lookups, 1 );
+    COUNT ( tab, bytes_hashed, key_length );
+    if ( slot == tab->n_slots )
+    {
+        *value = NULL;
+        return TLHASH_ENOENT;
+    }
+    COUNT ( tab, n_hits, 1 );
+    *value = tab->entries[tab->slots[slot].entry-1].value;
+    return TLHASH_SUCCESS;
+}
+
+
+/* Removal leaves a hole in the entry array, and shifts the following
+ * slots of the probe sequence back by one so that no tombstones are
+ * needed in the index.
+ */
+int
+tlhash_remove_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash
+)
+{
+    size_t mask = tab->n_slots - 1;
+    size_t slot = find_slot ( tab, key, key_length, hash );
+    if ( slot == tab->n_slots )
+        return TLHASH_ENOENT;
+
+    tlhash_entry_t *e = &tab->entries[tab->slots[slot].entry-1];
+    if ( e->key_length > TLHASH_INLINE_KEY )
+        free ( e->key.ptr );
+    e->key_length = REMOVED;
+    tab->size -= 1;
+
+    size_t next = (slot + 1) & mask;
+    while ( tab->slots[next].entry != 0 &&
+            ((next - tab->slots[next].hash) & mask) != 0 )
     {
-        tab->size -= 1;
-        return TLHASH_SUCCESS;
+        tab->slots[slot] = tab->slots[next];
+        slot = next;
+        next = (next + 1) & mask;
     }
+    tab->slots[slot] = (tlhash_slot_t) { .hash = 0, .entry = 0 };
+
+    if ( tab->n_entries - tab->size > tab->n_entries / 2 )
+        rebuild ( tab, tab->n_slots );
+    return TLHASH_SUCCESS;
 }
 
 
@@ -182,19 +270,67 @@ tlhash_size ( tlhash_t *tab )
 }
 
 
+/* Statistics - the shape of the index is measured on the spot, lookup
+ * counts are only there if counting was on
+ */
+void
+tlhash_stats ( tlhash_t *tab, tlhash_stats_t *stats )
+{
+    size_t mask = tab->n_slots - 1, total = 0;
+    *stats = (tlhash_stats_t) {
+        .size = tab->size,
+        .n_slots = tab->n_slots,
+        .load_factor = (double) tab->size / tab->n_slots
+    };
+    for ( size_t slot=0; slot<tab->n_slots; slot++ )
+    {
+        if ( tab->slots[slot].entry == 0 )
+            continue;
+        size_t length = ((slot - tab->slots[slot].hash) & mask) + 1;
+        stats->probe_lengths[
+            (length < TLHASH_PROBE_BUCKETS) ? length-1 : TLHASH_PROBE_BUCKETS-1
+        ] += 1;
+        if ( length > stats->max_probe_length )
+            stats->max_probe_length = length;
+        total += length;
+    }
+    if ( tab->size > 0 )
+        stats->mean_probe_length = (double) total / tab->size;
+    if ( ! counting )
+        return;
+    stats->counted = 1;
+    stats->n_lookups = tab->counters.n_lookups;
+    stats->n_hits = tab->counters.n_hits;
+    stats->n_misses = stats->n_lookups - stats->n_hits;
+    if ( stats->n_lookups > 0 )
+        stats->mean_bytes_hashed = (double) tab->counters.bytes_hashed / stats->n_lookups;
+}
+
+
+/* Turns lookup counting on or off for all tables. Like the choice of
+ * backend, this has to happen before any thread uses a table; with
+ * counting off, a lookup pays only for the test.
+ */
+void
+tlhash_set_counting ( int on )
+{
+    counting = on;
+}
+
+
+/* Keys point into the table, and stay valid until it is next modified */
 void
 tlhash_keys ( tlhash_t *tab, void **keys )
 {
-    size_t b, i = 0;
-    for ( b=0; b<tab->n_buckets; b++ )
+    size_t e, i = 0;
+    for ( e=0; e<tab->n_entries; e++ )
     {
-        tlhash_element_t *el = tab->buckets[b];
-        while ( el != NULL )
-        {
-            keys[i] = el->key;
-            i += 1;
-            el = el->next;
-        }
+        tlhash_entry_t *el = &tab->entries[e];
+        if ( el->key_length == REMOVED )
+            continue;
+        keys[i] = (el->key_length > TLHASH_INLINE_KEY) ?
+            el->key.ptr : (void *)el->key.bytes;
+        i += 1;
     }
 }
 
@@ -202,17 +338,182 @@ tlhash_keys ( tlhash_t *tab, void **keys )
 void
 tlhash_values ( tlhash_t *tab, void **values )
 {
-    size_t b, i = 0;
-    for ( b=0; b<tab->n_buckets; b++ )
+    size_t e, i = 0;
+    for ( e=0; e<tab->n_entries; e++ )
+    {
+        tlhash_entry_t *el = &tab->entries[e];
+        if ( el->key_length == REMOVED )
+            continue;
+        values[i] = el->value;
+        i += 1;
+    }
+}
+
+
+/* Select a hash backend by name. This has to happen before any table
+ * is filled through the plain (un-_hashed) functions.
+ * Returns
+ *  ENOENT - if there is no such backend, or the CPU does not support it.
+ */
+int
+tlhash_set_hash ( const char *name )
+{
+    for ( size_t b=0; b<N_BACKENDS; b++ )
+        if ( ! strcmp ( name, backends[b].name ) )
+        {
+            if ( ! backend_supported ( b ) )
+                return TLHASH_ENOENT;
+            hash_fn = backends[b].fn;
+            hash_name = backends[b].name;
+            return TLHASH_SUCCESS;
+        }
+    return TLHASH_ENOENT;
+}
+
+
+const char *
+tlhash_hash_name ( void )
+{
+    if ( hash_name == NULL )
+        resolve_hash ( NULL, 0 );
+    return hash_name;
+}
+
+
+/* Hash with the selected backend, for keys hashed outside the table */
+uint32_t
+tlhash_hash ( const void *key, size_t key_length )
+{
+    return hash_fn ( key, key_length );
+}
+
+
+/* Sets of pointers, kept in a table with the pointers as keys */
+int
+in_set ( tlhash_t *set, const void *pointer )
+{
+    void *value;
+    return tlhash_lookup ( set, &pointer, sizeof(pointer), &value ) == TLHASH_SUCCESS;
+}
+
+
+int
+add_to_set ( tlhash_t *set, const void *pointer )
+{
+    return tlhash_insert ( set, &pointer, sizeof(pointer), (void *) pointer );
+}
+
+
+/* Maps from pointers to indices, with index+1 as the value so that
+ * index 0 is not a NULL value; NO_INDEX for a pointer not in the map
+ */
+uint32_t
+lookup_index ( tlhash_t *map, const void *pointer )
+{
+    void *value;
+    if ( tlhash_lookup ( map, &pointer, sizeof(pointer), &value ) != TLHASH_SUCCESS )
+        return NO_INDEX;
+    return (uint32_t)((uintptr_t) value - 1);
+}
+
+
+int
+store_index ( tlhash_t *map, const void *pointer, uint32_t index )
+{
+    return tlhash_insert (
+        map, &pointer, sizeof(pointer), (void *)((uintptr_t) index + 1)
+    );
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+/* Returns the slot indexing key, or n_slots if there is none. Robin
+ * Hood ordering lets the search stop as soon as it meets a slot that is
+ * closer to its home position than the key would be at this point.
+ */
+static size_t
+find_slot ( tlhash_t *tab, void *key, size_t key_length, uint32_t hash )
+{
+    size_t mask = tab->n_slots - 1, slot = hash & mask, distance = 0;
+    for ( ;; )
+    {
+        tlhash_slot_t s = tab->slots[slot];
+        if ( s.entry == 0 || ((slot - s.hash) & mask) < distance )
+            return tab->n_slots;
+        if ( s.hash == hash )
+        {
+            tlhash_entry_t *e = &tab->entries[s.entry-1];
+            void *e_key = (e->key_length > TLHASH_INLINE_KEY) ?
+                e->key.ptr : (void *)e->key.bytes;
+            if ( e->key_length == key_length &&
+                 ! memcmp ( e_key, key, key_length ) )
+                return slot;
+        }
+        slot = (slot + 1) & mask;
+        distance += 1;
+    }
+}
+
+
+/* Insert an index slot, displacing slots that are closer to home */
+static void
+place ( tlhash_t *tab, uint32_t hash, uint32_t entry )
+{
+    size_t mask = tab->n_slots - 1, slot = hash & mask, distance = 0;
+    tlhash_slot_t carry = { .hash = hash, .entry = entry };
+    while ( tab->slots[slot].entry != 0 )
     {
-        tlhash_element_t *el = tab->buckets[b];
-        while ( el != NULL )
+        size_t d = (slot - tab->slots[slot].hash) & mask;
+        if ( d < distance )
         {
-            values[i] = el->value;
-            i += 1;
-            el = el->next;
+            tlhash_slot_t tmp = tab->slots[slot];
+            tab->slots[slot] = carry;
+            carry = tmp;
+            distance = d;
         }
+        slot = (slot + 1) & mask;
+        distance += 1;
     }
+    tab->slots[slot] = carry;
+}
+
+
+/* Compact the entry array and re-index it into n_slots slots */
+static int
+rebuild ( tlhash_t *tab, size_t n_slots )
+{
+    size_t max_entries = MAX_LOAD(n_slots);
+    tlhash_slot_t *slots = calloc ( n_slots, sizeof(tlhash_slot_t) );
+    if ( slots == NULL )
+        return TLHASH_ENOMEM;
+    if ( max_entries != tab->max_entries )
+    {
+        tlhash_entry_t *entries = realloc (
+            tab->entries, max_entries * sizeof(tlhash_entry_t)
+        );
+        if ( entries == NULL )
+        {
+            free ( slots );
+            return TLHASH_ENOMEM;
+        }
+        tab->entries = entries;
+        tab->max_entries = max_entries;
+    }
+    size_t live = 0;
+    for ( size_t e=0; e<tab->n_entries; e++ )
+        if ( tab->entries[e].key_length != REMOVED )
+            tab->entries[live++] = tab->entries[e];
+    free ( tab->slots );
+    tab->slots = slots;
+    tab->n_slots = n_slots;
+    tab->n_entries = live;
+    for ( size_t e=0; e<live; e++ )
+        place ( tab, tab->entries[e].hash, e+1 );
+    return TLHASH_SUCCESS;
 }
 
 
@@ -221,10 +522,43 @@ tlhash_values ( tlhash_t *tab, void **values )
  ***************************************/
 
 
+/* First call through hash_fn: settle on the best supported backend */
+static uint32_t
+resolve_hash ( const void *input, size_t length )
+{
+    size_t b = 0;
+    while ( ! backend_supported ( b ) )
+        b += 1;
+    hash_fn = backends[b].fn;
+    hash_name = backends[b].name;
+    return hash_fn ( input, length );
+}
+
+
+static uint64_t
+load64 ( const uint8_t *p )
+{
+    uint64_t word;
+    memcpy ( &word, p, sizeof(word) );
+    return word;
+}
+
+
+/* Up to 7 trailing bytes, zero-padded into one word */
+static uint64_t
+load_tail ( const uint8_t *p, size_t n )
+{
+    uint64_t word = 0;
+    memcpy ( &word, p, n );
+    return word;
+}
+
+
+/* Table-driven CRC32, one byte at a time. Works everywhere. */
 static uint32_t
-crc32 ( void *input, size_t length )
+crc32 ( const void *input, size_t length )
 {
-    const uint8_t *data = (uint8_t *)input;
+    const uint8_t *data = (const uint8_t *)input;
     size_t i = 0;
     uint32_t hash = 0xFFFFFFFF;
     for ( i = 0; i<length; i++ )
@@ -233,6 +567,87 @@ crc32 ( void *input, size_t length )
 }
 
 
+/* CRC32C with the SSE4.2 instruction, eight bytes at a time */
+#ifdef HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c ( const void *input, size_t length )
+{
+    const uint8_t *data = (const uint8_t *)input;
+    uint64_t hash = 0xFFFFFFFF;
+    for ( ; length >= 8; data += 8, length -= 8 )
+        hash = _mm_crc32_u64 ( hash, load64 ( data ) );
+    if ( length > 0 )
+        hash = _mm_crc32_u64 ( hash, load_tail ( data, length ) ^ length );
+    return (uint32_t)hash ^ 0xFFFFFFFF;
+}
+#else
+static uint32_t
+crc32c ( const void *input, size_t length )
+{
+    return crc32 ( input, length );
+}
+#endif
+
+
+/* Multiply-based hash in the style of wyhash: each pair of words is
+ * folded in with one 64x64->128 bit multiplication.
+ */
+#define MUM_K0 0xa0761d6478bd642full
+#define MUM_K1 0xe7037ed1a0b428dbull
+#define MUM_K2 0x8ebc6af09c88c6e3ull
+
+static uint64_t
+mum ( uint64_t a, uint64_t b )
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t r = a * (b | 1);
+    return r ^ (r >> 29);
+#endif
+}
+
+
+static uint32_t
+mum_hash ( const void *input, size_t length )
+{
+    const uint8_t *data = (const uint8_t *)input;
+    uint64_t seed = MUM_K0 ^ length;
+    for ( ; length >= 16; data += 16, length -= 16 )
+        seed = mum ( load64 ( data ) ^ MUM_K1, load64 ( data+8 ) ^ seed );
+    if ( length >= 8 )
+    {
+        seed = mum ( load64 ( data ) ^ MUM_K1, seed ^ MUM_K2 );
+        data += 8;
+        length -= 8;
+    }
+    if ( length > 0 )
+        seed = mum ( load_tail ( data, length ) ^ MUM_K2, seed ^ MUM_K1 );
+    seed = mum ( seed ^ MUM_K0, MUM_K1 );
+    return (uint32_t)(seed ^ (seed >> 32));
+}
+
+
+static int
+backend_supported ( size_t b )
+{
+#ifdef HAVE_SSE42_CRC
+    if ( backends[b].fn == crc32c )
+        return __builtin_cpu_supports ( "sse4.2" );
+#else
+    if ( backends[b].fn == crc32c )
+        return 0;
+#endif
+#ifndef __SIZEOF_INT128__
+    if ( backends[b].fn == mum_hash )
+        return 0;
+#endif
+    return 1;
+}
+
+
 static const uint32_t
 crc32_ieee802_3[256] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
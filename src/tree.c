@@ -1,38 +1,165 @@
 #include <vslc.h>
 
 
-void
-node_print ( node_t *root, int nesting )
+/* Walk frames live on the heap, so the depth of the tree is limited by
+ * memory rather than by the native stack.
+ */
+typedef struct {
+    node_t **slot;
+    uint64_t next_child;
+} walk_frame_t;
+
+#define NOT_ENTERED UINT64_MAX
+
+
+/* Generic depth-first traversal. pre is called on the way down and may
+ * return the number of leading children to skip (WALK_SKIP_CHILDREN
+ * skips them all), post is called on the way up and may replace the
+ * node through its slot. Either may be NULL. Empty (NULL) slots are
+ * only reported to pre. A negative return from a callback stops the
+ * walk, and is returned.
+ * Returns 0, a callback's negative value, or WALK_ENOMEM.
+ */
+int
+tree_walk ( node_t **root, walk_fn pre, walk_fn post, void *context )
+{
+    size_t n_frames = 1, max_frames = 64;
+    walk_frame_t *frames = malloc ( max_frames * sizeof(walk_frame_t) );
+    if ( frames == NULL )
+        return WALK_ENOMEM;
+    frames[0] = (walk_frame_t) { .slot = root, .next_child = NOT_ENTERED };
+
+    int result = 0;
+    while ( n_frames > 0 )
+    {
+        walk_frame_t *frame = &frames[n_frames-1];
+        uint64_t depth = n_frames - 1;
+
+        if ( frame->next_child == NOT_ENTERED )
+        {
+            int skip = 0;
+            if ( pre != NULL && (skip = pre ( frame->slot, depth, context )) < 0 )
+            {
+                result = skip;
+                break;
+            }
+            if ( *frame->slot == NULL )
+            {
+                n_frames -= 1;
+                continue;
+            }
+            frame->next_child = (uint64_t) skip;
+        }
+
+        node_t *node = *frame->slot;
+        if ( frame->next_child < node->n_children )
+        {
+            node_t **child = &node->children[frame->next_child++];
+            if ( n_frames == max_frames )
+            {
+                walk_frame_t *grown = realloc (
+                    frames, 2 * max_frames * sizeof(walk_frame_t)
+                );
+                if ( grown == NULL )
+                {
+                    result = WALK_ENOMEM;
+                    break;
+                }
+                frames = grown;
+                max_frames *= 2;
+            }
+            frames[n_frames++] = (walk_frame_t) {
+                .slot = child, .next_child = NOT_ENTERED
+            };
+        }
+        else
+        {
+            if ( post != NULL && (result = post ( frame->slot, depth, context )) < 0 )
+                break;
+            result = 0;
+            n_frames -= 1;
+        }
+    }
+
+    free ( frames );
+    return result;
+}
+
+
+typedef struct {
+    writer_t *out;
+    int nesting;
+} print_state_t;
+
+
+/* Indentation is as printf's "%*c" with a space: at least one column */
+static int
+print_node ( node_t **slot, uint64_t depth, void *context )
 {
+    print_state_t *state = context;
+    writer_t *out = state->out;
+    node_t *root = *slot;
+    uint64_t nesting = state->nesting + depth;
+    writer_pad ( out, ' ', (nesting > 1) ? nesting : 1 );
     if ( root != NULL )
     {
-        printf ( "%*c%s", nesting, ' ', node_string[root->type] );
-        if ( root->type == IDENTIFIER_DATA ||
-             root->type == STRING_DATA ||
-             root->type == RELATION ||
-             root->type == EXPRESSION ) 
-            printf ( "(%s)", (char *) root->data );
+        writer_string ( out, node_string[root->type] );
+        if ( root->type == IDENTIFIER_DATA )
+        {
+            writer_char ( out, '(' );
+            writer_string ( out, ((ident_t *) root->data)->text );
+            writer_char ( out, ')' );
+        }
+        else if ( root->type == STRING_DATA )
+        {
+            writer_char ( out, '(' );
+            writer_string ( out, (char *) root->data );
+            writer_char ( out, ')' );
+        }
+        else if ( root->type == RELATION || root->type == EXPRESSION )
+        {
+            writer_char ( out, '(' );
+            writer_string ( out, operator_string[root->op] );
+            writer_char ( out, ')' );
+        }
         else if ( root->type == NUMBER_DATA )
-            printf ( "(%ld)", *((int64_t *)root->data) );
-        putchar ( '\n' );
-        for ( int64_t i=0; i<root->n_children; i++ )
-            node_print ( root->children[i], nesting+1 );
+        {
+            writer_char ( out, '(' );
+            writer_int ( out, *((int64_t *)root->data) );
+            writer_char ( out, ')' );
+        }
+        writer_char ( out, '\n' );
     }
     else
-        printf ( "%*c%p\n", nesting, ' ', root );
+        writer_string ( out, "(nil)\n" );
+    return WALK_CONTINUE;
 }
 
 
 void
-node_init (node_t *nd, node_index_t type, void *data, uint64_t n_children, ...)
+node_print ( writer_t *out, node_t *root, int nesting )
+{
+    print_state_t state = { .out = out, .nesting = nesting };
+    tree_walk ( &root, print_node, NULL, &state );
+}
+
+
+void
+node_init (
+    node_t *nd, arena_t *arena, node_index_t type, void *data,
+    uint64_t n_children, ...
+)
 {
     va_list child_list;
     *nd = (node_t) {
         .type = type,
+        .op = OP_NONE,
         .data = data,
         .entry = NULL,
         .n_children = n_children,
-        .children = (node_t **) malloc ( n_children * sizeof(node_t *) )
+        .children = (node_t **) arena_alloc (
+            arena, n_children * sizeof(node_t *)
+        )
     };
     va_start ( child_list, n_children );
     for ( uint64_t i=0; i<n_children; i++ )
@@ -41,53 +168,190 @@ node_init (node_t *nd, node_index_t type, void *data, uint64_t n_children, ...)
 }
 
 
+/* Nodes, child arrays and node data all live in the context's tree
+ * arena, so the whole tree is torn down with a single release.
+ */
 void
-node_finalize ( node_t *discard )
+destroy_tree ( vslc_context_t *ctx )
+{
+    arena_release ( &ctx->tree_arena );
+    ctx->root = NULL;
+}
+
+
+/* Append a child to a list node. The child array is grown to the next
+ * power of two whenever it fills up, so building an N-item list costs
+ * O(N) copying in total. Capacity is not stored: it is the smallest
+ * power of two that holds n_children, which holds for every list since
+ * the parser starts them with a single child.
+ */
+static void
+node_append ( arena_t *arena, node_t *list, node_t *child )
+{
+    uint64_t n = list->n_children;
+    if ( n > 0 && (n & (n-1)) == 0 )
+        list->children = arena_grow (
+            arena, list->children,
+            n * sizeof(node_t *), 2 * n * sizeof(node_t *)
+        );
+    list->children[list->n_children++] = child;
+}
+
+
+static bool
+is_number ( node_t *node )
+{
+    return node != NULL && node->type == NUMBER_DATA;
+}
+
+
+/* Computes x op y into x. Arithmetic wraps around in 64 bits and
+ * division truncates; a division by zero, or of INT64_MIN by -1, is
+ * not computed but left for run time. Shift counts are taken modulo 64
+ * and >> shifts the sign in, as the machine does. Relations are 1 when
+ * they hold and 0 otherwise.
+ * Returns false if x is left as it was.
+ */
+static bool
+evaluate ( operator_t op, int64_t *x, int64_t y )
 {
-    if ( discard != NULL )
+    uint64_t a = *x, b = y;
+    switch ( op )
     {
-        free ( discard->data );
-        free ( discard->children );
-        free ( discard );
+        case OP_ADD: a += b; break;
+        case OP_SUB: a -= b; break;
+        case OP_MUL: a *= b; break;
+        case OP_DIV:
+            if ( y == 0 || (*x == INT64_MIN && y == -1) )
+                return false;
+            a = *x / y;
+            break;
+        case OP_LSHIFT: a <<= (b & 63); break;
+        case OP_RSHIFT:
+            a = ( *x < 0 ) ? ~(~a >> (b & 63)) : a >> (b & 63);
+            break;
+        case OP_AND: a &= b; break;
+        case OP_XOR: a ^= b; break;
+        case OP_OR: a |= b; break;
+        case OP_EQ: a = ( *x == y ); break;
+        case OP_LT: a = ( *x < y ); break;
+        case OP_GT: a = ( *x > y ); break;
+        default: return false;
     }
+    *x = (int64_t) a;
+    return true;
 }
 
 
-void
-destroy_subtree ( node_t *discard )
+/* Gathers the constants of a + or * chain into one operand on its
+ * right, as in (x + 1) + (y + 2) => (x + y) + 3, and drops it if it
+ * is the identity. Children are already simplified, so each holds at
+ * most one constant, on its right. Subtracting a constant is adding
+ * its negation. Operands only move past constants, so the variables
+ * and calls keep their order.
+ */
+static node_t *
+reassociate ( node_t *root )
 {
-    if ( discard != NULL )
+    if ( root->op == OP_SUB && is_number ( root->children[1] ) )
+    {
+        int64_t *c = root->children[1]->data;
+        *c = (int64_t) (0 - (uint64_t) *c);
+        root->op = OP_ADD;
+    }
+    if ( root->op != OP_ADD && root->op != OP_MUL )
+        return root;
+
+    node_t *terms[2], *constant = NULL, *spare = NULL;
+    int n_terms = 0;
+    for ( int c=0; c<2; c++ )
+    {
+        node_t *child = root->children[c], *number = NULL;
+        if ( is_number ( child ) )
+            number = child;
+        else if ( child->type == EXPRESSION && child->op == root->op &&
+                  child->n_children == 2 && is_number ( child->children[1] ) )
+        {
+            number = child->children[1];
+            terms[n_terms++] = child->children[0];
+            spare = child;
+        }
+        else
+            terms[n_terms++] = child;
+        if ( number == NULL )
+            continue;
+        if ( constant == NULL )
+            constant = number;
+        else
+            evaluate ( root->op, constant->data, *((int64_t *) number->data) );
+    }
+    if ( constant == NULL )
+        return root;
+
+    node_t *term = terms[0];
+    if ( n_terms == 2 )
     {
-        for ( uint64_t i=0; i<discard->n_children; i++ )
-            destroy_subtree ( discard->children[i] );
-        node_finalize ( discard );
+        spare->children[0] = terms[0];
+        spare->children[1] = terms[1];
+        term = spare;
     }
+    int64_t value = *((int64_t *) constant->data);
+    if ( value == ( root->op == OP_ADD ? 0 : 1 ) )
+        return term;
+    root->children[0] = term;
+    root->children[1] = constant;
+    return root;
 }
 
 
-void
-simplify_tree ( node_t **simplified, node_t *root )
+/* Folds an expression or relation whose operands are constants into
+ * its left operand, and reassociates the rest
+ */
+static node_t *
+fold ( node_t *root )
 {
-    if ( root == NULL )
-        return;
+    if ( root->n_children == 1 )
+    {
+        node_t *child = root->children[0];
+        if ( root->op == OP_NONE )
+            return child;
+        if ( !is_number ( child ) )
+            return root;
+        int64_t *x = child->data;
+        *x = ( root->op == OP_NEG ) ? (int64_t) (0 - (uint64_t) *x) : ~*x;
+        return child;
+    }
+    /* Function calls are the binary expressions without an operator */
+    if ( root->n_children != 2 || root->op == OP_NONE )
+        return root;
+    node_t *left = root->children[0], *right = root->children[1];
+    if ( is_number ( left ) && is_number ( right ) )
+        return evaluate ( root->op, left->data, *((int64_t *) right->data) ) ? left : root;
+    if ( root->type == RELATION )
+        return root;
+    return reassociate ( root );
+}
 
-    /* Simplify subtrees before examining this node */
-    for ( uint64_t i=0; i<root->n_children; i++ )
-        simplify_tree ( &root->children[i], root->children[i] );
 
-    node_t *discard, *result = root;
+/* Simplification of one node, once its subtrees are simplified. Nodes
+ * that are spliced out are simply dropped; their memory belongs to the
+ * tree arena (the walk context) and is reclaimed by destroy_tree.
+ */
+static int
+simplify_node ( node_t **simplified, uint64_t depth, void *context )
+{
+    arena_t *arena = context;
+    node_t *root = *simplified, *result = root;
     switch ( root->type )
     {
         /* Structures of purely syntactic function */
         case PARAMETER_LIST: case ARGUMENT_LIST:
         case STATEMENT: case PRINT_ITEM: case GLOBAL:
             result = root->children[0];
-            node_finalize ( root );
             break;
         case PRINT_STATEMENT:
             result = root->children[0];
             result->type = PRINT_STATEMENT;
-            node_finalize(root);
         /* Flatten lists:
          * Take left child, append right child, substitute left for root.
          */
@@ -96,165 +360,42 @@ simplify_tree ( node_t **simplified, node_t *root )
             if ( root->n_children >= 2 )
             {
                 result = root->children[0];
-                result->n_children += 1;
-                result->children = realloc (
-                    result->children, result->n_children * sizeof(node_t *)
-                );
-                result->children[result->n_children-1] = root->children[1];
-                node_finalize ( root );
+                node_append ( arena, result, root->children[1] );
             }
             break;
-        case EXPRESSION:
-            switch ( root->n_children )
-            {
-                case 1:
-                    if ( root->children[0]->type == NUMBER_DATA )
-                    {
-                        result = root->children[0];
-                        if ( root->data != NULL )
-                            *((int64_t *)result->data) *= -1;
-                        node_finalize (root);
-                    }
-                    else if ( root->data == NULL )
-                    {
-                        result = root->children[0];
-                        node_finalize (root);
-                    }
-                    break;
-                case 2:
-                    if ( root->children[0]->type == NUMBER_DATA &&
-                         root->children[1]->type == NUMBER_DATA
-                    ) {
-                        result = root->children[0];
-                        int64_t
-                            *x = result->data,
-                            *y = root->children[1]->data;
-                       // Evaluate the expressiongs for this
-		       
-			char *cc = ((char *)root->data);
-	
-			// strcmp for leftshift and rightshift
-			
-			if((strcmp(cc,"+")==0)){
-			*x += *y; 
-			}else if ((strcmp(cc,"-")==0)){
-			*x -= *y; 
-			}else if ((strcmp(cc,"*")==0)){
-			*x *= *y; 
-			}else if ((strcmp(cc,"/")==0)){
-			*x %= *y; 
-			}else if ((strcmp(cc,"<<")==0)){
-			*x =  *x << *y; 
-			}else if ((strcmp(cc,">>")==0)){
-			*x =  *x >> *y; 
-			}else if ((strcmp(cc,"&")==0)){
-			*x =  *x & *y;
-			}else if ((strcmp(cc,"^")==0)){
-			*x =  *x ^ *y;
-			}else if ((strcmp(cc,"|")==0)){
-			*x =  *x | *y;
-			}else{
-			// do nothing
-			}
-		
-			
-			/*
-			switch ( *((char *)root->data) )
-			{
-                            case '+': *x += *y; break;
-                            case '-': *x -= *y; break;
-                            case '*': *x *= *y; break;
-                            case '/': *x /= *y; break;
-			  //  case '<<': *x  = *x << *y; break; 
-                        }
-			*/
-
-                        node_finalize ( root->children[1] );
-                        node_finalize ( root );
-                    }
-                    break;
-            }
+        case EXPRESSION: case RELATION:
+            result = fold ( root );
+            break;
     }
 
     *simplified = result;
+    return WALK_CONTINUE;
 }
 
+
 void
-simplify_tree2 ( node_t **simplified, node_t *root )
+simplify_tree ( node_t **simplified, node_t *root, arena_t *arena )
 {
-    if ( root == NULL )
-        return;
+    *simplified = root;
+    tree_walk ( simplified, NULL, simplify_node, arena );
+}
 
-    /* Simplify subtrees before examining this node */
-    for ( uint64_t i=0; i<root->n_children; i++ )
-        simplify_tree ( &root->children[i], root->children[i] );
 
-    node_t *discard, *result = root;
-    switch ( root->type )
-    {
-        /* Structures of purely syntactic function */
-        case PARAMETER_LIST: case ARGUMENT_LIST:
-        case STATEMENT: case PRINT_ITEM: case GLOBAL:
-            result = root->children[0];
-            node_finalize ( root );
-            break;
-        case PRINT_STATEMENT:
-            result = root->children[0];
-            result->type = PRINT_STATEMENT;
-            node_finalize(root);
-        /* Flatten lists:
-         * Take left child, append right child, substitute left for root.
-         */
-        case STATEMENT_LIST: case DECLARATION_LIST: case GLOBAL_LIST:
-        case PRINT_LIST: case EXPRESSION_LIST: case VARIABLE_LIST:
-            if ( root->n_children >= 2 )
-            {
-                result = root->children[0];
-                result->n_children += 1;
-                result->children = realloc (
-                    result->children, result->n_children * sizeof(node_t *)
-                );
-                result->children[result->n_children-1] = root->children[1];
-                node_finalize ( root );
-            }
-            break;
-        case EXPRESSION:
-            switch ( root->n_children )
-            {
-                case 1:
-                    if ( root->children[0]->type == NUMBER_DATA )
-                    {
-                        result = root->children[0];
-                        if ( root->data != NULL )
-                            *((int64_t *)result->data) *= -1;
-                        node_finalize (root);
-                    }
-                    else if ( root->data == NULL )
-                    {
-                        result = root->children[0];
-                        node_finalize (root);
-                    }
-                    break;
-                case 2:
-                    if ( root->children[0]->type == NUMBER_DATA &&
-                         root->children[1]->type == NUMBER_DATA
-                    ) {
-                        result = root->children[0];
-                        int64_t
-                            *x = result->data,
-                            *y = root->children[1]->data;
-                        switch ( *((char *)root->data) )
-                        {
-                            case '+': *x += *y; break;
-                            case '-': *x -= *y; break;
-                            case '*': *x *= *y; break;
-                            case '/': *x /= *y; break;
-                        }
-                        node_finalize ( root->children[1] );
-                        node_finalize ( root );
-                    }
-                    break;
-            }
-    }
-    *simplified = result;
+static int
+fold_node ( node_t **slot, uint64_t depth, void *context )
+{
+    node_t *root = *slot;
+    if ( root->type == EXPRESSION || root->type == RELATION )
+        *slot = fold ( root );
+    return WALK_CONTINUE;
+}
+
+
+/* Folds the expressions of a simplified subtree again, for passes that
+ * put constants where there were none
+ */
+void
+fold_tree ( node_t **root )
+{
+    tree_walk ( root, NULL, fold_node, NULL );
 }
@@ -1,28 +1,350 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <vslc.h>
 
 
-node_t *root;               // Syntax tree                  
-tlhash_t *global_names;     // Symbol table        
-char **string_list;         // List of strings in the source
-size_t n_string_list = 8;   // Initial string list capacity (grow on demand)                                            
-size_t stringc = 0;         // Initial string count
+bool use_flat = false;      // Print bindings from the flat tree
+const char *save_name = NULL;   // Write the compiled program's image here
+bool show_stats = false;    // Report what each phase cost on stderr
+bool show_tables = false;   // Report the symbol tables' shape on stderr
+bool optimizing = false;    // Run the optimization passes on the bound tree
+
+// Batch mode: one compilation per input file, each to its own listing
+typedef struct {
+    char **files;
+    int *failed;
+} batch_t;
+
+static int compile ( vslc_context_t *ctx, FILE *in );
+static void compile_file ( size_t index, void *batch );
+static int finish ( vslc_context_t *ctx );
+static int load ( const char *name );
 
 
 
 int
 main ( int argc, char **argv )
 {
-    string_list = malloc(n_string_list * sizeof(char*));
-    yyparse();
-    simplify_tree(&root, root);
-    // node_print(root, 0);
+    unsigned n_threads = 0;
+    const char *load_name = NULL;
+    char **files = malloc ( argc * sizeof(char *) );
+    size_t n_files = 0;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp(argv[i], "--hash") && i + 1 < argc )
+        {
+            // Pick the tlhash backend instead of the best one the CPU supports
+            if ( tlhash_set_hash(argv[++i]) != TLHASH_SUCCESS )
+            {
+                fprintf(stderr, "Unknown or unsupported hash '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if ( !strcmp(argv[i], "--flat") )
+        {
+            // Print bindings from the index-based tree
+            use_flat = true;
+        }
+        else if ( !strcmp(argv[i], "--save") && i + 1 < argc )
+        {
+            // Keep the compiled program as an image, for --load
+            save_name = argv[++i];
+        }
+        else if ( !strcmp(argv[i], "--load") && i + 1 < argc )
+        {
+            // List a saved image instead of compiling
+            load_name = argv[++i];
+        }
+        else if ( !strcmp(argv[i], "--stats") )
+        {
+            // Time, allocations and symbol table use of every phase
+            show_stats = true;
+        }
+        else if ( !strcmp(argv[i], "--table-stats") )
+        {
+            // Load and probe lengths of every symbol table, for sizing them
+            show_tables = true;
+        }
+        else if ( !strcmp(argv[i], "-O") )
+        {
+            // Optimize the program before it is listed or saved
+            optimizing = true;
+        }
+        else if ( !strcmp(argv[i], "-j") && i + 1 < argc )
+        {
+            // Threads to compile on, all processors by default
+            n_threads = strtoul(argv[++i], NULL, 10);
+        }
+        else
+            files[n_files++] = argv[i];
+    }
+
+    // An image holds one program, and batch mode compiles several
+    if ( save_name != NULL && n_files > 0 )
+    {
+        fprintf(stderr, "--save takes a single program on stdin, not input files\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Settle the hash backend and counting before threads start using them
+    tlhash_hash_name();
+    if ( show_tables )
+        tlhash_set_counting(1);
+
+    if ( load_name != NULL )
+    {
+        int status = load(load_name);
+        free(files);
+        exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Single program from stdin, listing on stdout
+    if ( n_files == 0 )
+    {
+        vslc_context_t ctx;
+        if ( vslc_context_init(&ctx, STDOUT_FILENO, NULL) != CONTEXT_SUCCESS )
+            exit(EXIT_FAILURE);
+        // The one program gets the threads, to bind its functions on
+        ctx.n_threads = ( n_threads > 0 ) ? n_threads : parallel_cpus();
+        int status = compile(&ctx, stdin);
+        if ( finish(&ctx) != CONTEXT_SUCCESS )
+            status = -1;
+        free(files);
+        exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Batch mode: each file.vsl is compiled to file.tree, one file per thread
+    if ( n_threads == 0 )
+        n_threads = parallel_cpus();
+    batch_t batch = {
+        .files = files,
+        .failed = calloc(n_files, sizeof(int))
+    };
+    parallel_for(n_files, n_threads, compile_file, &batch);
+
+    int status = EXIT_SUCCESS;
+    for ( size_t f = 0; f < n_files; f++ )
+        if ( batch.failed[f] )
+            status = EXIT_FAILURE;
+    free(batch.failed);
+    free(files);
+    exit(status);
+}
+
+
+/* Runs the whole pipeline on one program. Returns nonzero if it did not
+ * parse; the context is finalized by the caller either way.
+ */
+static int
+compile ( vslc_context_t *ctx, FILE *in )
+{
+    void *scanner;
+    if ( yylex_init(&scanner) != 0 )
+        return -1;
+    // The stats live until finish() has reported them
+    if ( show_stats )
+    {
+        ctx->stats = malloc(sizeof(vslc_stats_t));
+        if ( ctx->stats != NULL )
+        {
+            stats_init(ctx->stats, ctx->n_threads > 1);
+            stats_start(ctx->stats, ctx);
+        }
+    }
+
+    // Regular files are scanned in place, pipes through flex's buffers
+    source_map_t source;
+    if ( source_map(&source, fileno(in)) == SOURCE_SUCCESS )
+        yy_scan_buffer(source.base, source.length + SOURCE_PADDING, scanner);
+    else
+        yyset_in(in, scanner);
+    int status = yyparse(ctx, scanner);
+    yylex_destroy(scanner);
+    // Identifiers are interned and strings copied, so the tree keeps
+    // nothing that points into the mapping
+    source_unmap(&source);
+    if ( ctx->stats != NULL )
+        stats_stop(ctx->stats, ctx, STATS_PARSE);
+    if ( status != 0 )
+        return status;
+
+    if ( ctx->stats != NULL )
+    {
+        ctx->stats->nodes_parsed = stats_count_nodes(ctx->root);
+        stats_start(ctx->stats, ctx);
+    }
+    simplify_tree(&ctx->root, ctx->root, &ctx->tree_arena);
+    // node_print(&ctx->out, ctx->root, 0);
+    if ( ctx->stats != NULL )
+    {
+        stats_stop(ctx->stats, ctx, STATS_SIMPLIFY);
+        ctx->stats->nodes_simplified = stats_count_nodes(ctx->root);
+        stats_start(ctx->stats, ctx);
+    }
+
+    tlhash_stats_t scope_tables = { .size = 0 };
+    if ( show_tables )
+        ctx->scope_tables = &scope_tables;
+    create_symbol_table(ctx);
+    if ( ctx->stats != NULL )
+    {
+        stats_stop(ctx->stats, ctx, STATS_SYMBOLS);
+        stats_start(ctx->stats, ctx);
+    }
+    if ( show_tables )
+    {
+        stats_report_tables(ctx, STDERR_FILENO);
+        ctx->scope_tables = NULL;
+    }
+    if ( optimizing )
+    {
+        optimize(ctx);
+        if ( ctx->stats != NULL )
+        {
+            stats_stop(ctx->stats, ctx, STATS_OPTIMIZE);
+            stats_start(ctx->stats, ctx);
+        }
+    }
+    if ( save_name != NULL )
+    {
+        int fd = open(save_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if ( fd < 0 || image_save(ctx, fd) != IMAGE_SUCCESS || close(fd) != 0 )
+        {
+            perror(save_name);
+            return -1;
+        }
+    }
+    if ( use_flat )
+    {
+        flat_tree_t flat;
+        if ( flat_init(&flat, 0) != FLAT_SUCCESS ||
+             flat_from_tree(&flat, ctx->root, true) != FLAT_SUCCESS )
+        {
+            fprintf(stderr, "Couldn't convert the syntax tree\n");
+            flat_finalize(&flat);
+            return -1;
+        }
+        print_symbols(ctx);
+        print_flat_bindings(ctx, &flat);
+        flat_finalize(&flat);
+    }
+    else
+        print_symbol_table(ctx);
+    if ( ctx->stats != NULL )
+        stats_stop(ctx->stats, ctx, STATS_PRINT);
+    return 0;
+}
+
+
+/* Finalizes a compiled context, reporting its stats if it kept any */
+static int
+finish ( vslc_context_t *ctx )
+{
+    vslc_stats_t *stats = ctx->stats;
+    if ( stats != NULL )
+        stats_start(stats, NULL);
+    int status = vslc_context_finalize(ctx);
+    if ( stats != NULL )
+    {
+        stats_stop(stats, NULL, STATS_TEARDOWN);
+        stats_report(stats, ctx->filename, STDERR_FILENO);
+        free(stats);
+    }
+    return status;
+}
 
-    create_symbol_table();
-	print_symbol_table();
 
-    destroy_subtree(root);
-    destroy_symbol_table();
+static void
+compile_file ( size_t index, void *arg )
+{
+    batch_t *batch = arg;
+    const char *name = batch->files[index];
+
+    // file.vsl becomes file.tree, other names get .tree appended
+    size_t length = strlen(name);
+    if ( length >= 4 && !strcmp(name + length - 4, ".vsl") )
+        length -= 4;
+    char *out_name = malloc(length + 6);
+    memcpy(out_name, name, length);
+    strcpy(out_name + length, ".tree");
+
+    FILE *in = fopen(name, "r");
+    int out = -1;
+    if ( in == NULL )
+        perror(name);
+    else if ( (out = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 )
+        perror(out_name);
+
+    vslc_context_t ctx;
+    if ( in == NULL || out < 0 ||
+         vslc_context_init(&ctx, out, name) != CONTEXT_SUCCESS )
+        batch->failed[index] = 1;
+    else
+    {
+        batch->failed[index] = ( compile(&ctx, in) != 0 );
+        if ( finish(&ctx) != CONTEXT_SUCCESS )
+        {
+            errno = ctx.out.error;
+            perror(out_name);
+            batch->failed[index] = 1;
+        }
+    }
+
+    if ( in != NULL )
+        fclose(in);
+    if ( out >= 0 && close(out) != 0 )
+    {
+        perror(out_name);
+        batch->failed[index] = 1;
+    }
+    free(out_name);
+}
+
+
+/* Lists the program in an image written by --save, the way compiling
+ * it with --flat would
+ */
+static int
+load ( const char *name )
+{
+    int fd = open(name, O_RDONLY);
+    if ( fd < 0 )
+    {
+        perror(name);
+        return -1;
+    }
+    image_t image;
+    int status = image_map(&image, fd);
+    close(fd);
+    if ( status != IMAGE_SUCCESS )
+    {
+        fprintf(stderr, "%s: not a usable image\n", name);
+        return -1;
+    }
 
+    vslc_context_t ctx;
+    flat_tree_t flat;
+    if ( vslc_context_init(&ctx, STDOUT_FILENO, NULL) != CONTEXT_SUCCESS )
+    {
+        image_unmap(&image);
+        return -1;
+    }
+    status = image_load(&ctx, &image, &flat);
+    if ( status == IMAGE_SUCCESS )
+    {
+        print_symbols(&ctx);
+        print_flat_bindings(&ctx, &flat);
+    }
+    else
+        fprintf(stderr, "%s: damaged image\n", name);
+    flat_finalize(&flat);
+    // The string table points into the image until the listing is out
+    if ( vslc_context_finalize(&ctx) != CONTEXT_SUCCESS )
+        status = -1;
+    image_unmap(&image);
+    return status;
 }
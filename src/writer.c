@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <writer.h>
+
+/* Two digits at a time, "00" to "99" */
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+static void write_all ( writer_t *writer, const char *bytes, size_t length );
+
+
+/********************************
+ * External interface functions *
+ ********************************/
+
+
+/* Initializer - a size 0 buffer takes the default size
+ * Returns
+ *  SUCCESS - writer is ready
+ *  ENOMEM - no memory available
+ */
+int
+writer_init ( writer_t *writer, int fd, size_t size )
+{
+    if ( size == 0 )
+        size = WRITER_BUFFER_SIZE;
+    *writer = (writer_t) {
+        .fd = fd, .error = 0, .used = 0, .size = size,
+        .buffer = malloc ( size )
+    };
+    return ( writer->buffer != NULL ) ? WRITER_SUCCESS : WRITER_ENOMEM;
+}
+
+
+void
+writer_bytes ( writer_t *writer, const char *bytes, size_t length )
+{
+    if ( length > writer->size - writer->used )
+    {
+        writer_flush ( writer );
+        /* Too big to be worth buffering */
+        if ( length > writer->size / 2 )
+        {
+            write_all ( writer, bytes, length );
+            return;
+        }
+    }
+    memcpy ( writer->buffer + writer->used, bytes, length );
+    writer->used += length;
+}
+
+
+void
+writer_string ( writer_t *writer, const char *string )
+{
+    writer_bytes ( writer, string, strlen ( string ) );
+}
+
+
+void
+writer_uint ( writer_t *writer, uint64_t value )
+{
+    char digits[20], *p = digits + sizeof(digits);
+    while ( value >= 100 )
+    {
+        p -= 2;
+        memcpy ( p, &digit_pairs[2 * (value % 100)], 2 );
+        value /= 100;
+    }
+    if ( value >= 10 )
+    {
+        p -= 2;
+        memcpy ( p, &digit_pairs[2 * value], 2 );
+    }
+    else
+        *--p = '0' + value;
+    writer_bytes ( writer, p, digits + sizeof(digits) - p );
+}
+
+
+void
+writer_int ( writer_t *writer, int64_t value )
+{
+    if ( value < 0 )
+    {
+        writer_char ( writer, '-' );
+        /* Negated as unsigned, which also covers INT64_MIN */
+        writer_uint ( writer, -(uint64_t) value );
+    }
+    else
+        writer_uint ( writer, value );
+}
+
+
+void
+writer_pad ( writer_t *writer, char c, size_t count )
+{
+    while ( count > 0 )
+    {
+        if ( writer->used == writer->size )
+            writer_flush ( writer );
+        size_t n = writer->size - writer->used;
+        if ( n > count )
+            n = count;
+        memset ( writer->buffer + writer->used, c, n );
+        writer->used += n;
+        count -= n;
+    }
+}
+
+
+/* Hands the buffer to the kernel in one write, or as few as it takes
+ * Returns
+ *  SUCCESS - everything written so far has reached the descriptor
+ *  EIO - a write failed, now or earlier
+ */
+int
+writer_flush ( writer_t *writer )
+{
+    write_all ( writer, writer->buffer, writer->used );
+    writer->used = 0;
+    return ( writer->error == 0 ) ? WRITER_SUCCESS : WRITER_EIO;
+}
+
+
+/* Finalizer - flushes and frees the buffer, the descriptor stays open
+ * Returns as writer_flush
+ */
+int
+writer_finalize ( writer_t *writer )
+{
+    int status = writer_flush ( writer );
+    free ( writer->buffer );
+    writer->buffer = NULL;
+    writer->size = 0;
+    return status;
+}
+
+
+/*********************
+ * Utility functions *
+ *********************/
+
+
+static void
+write_all ( writer_t *writer, const char *bytes, size_t length )
+{
+    while ( length > 0 && writer->error == 0 )
+    {
+        ssize_t n = write ( writer->fd, bytes, length );
+        if ( n < 0 )
+        {
+            if ( errno != EINTR )
+                writer->error = errno;
+            continue;
+        }
+        bytes += n;
+        length -= n;
+    }
+}